@@ -6,5 +6,20 @@
 #include "VelocityArrowShader.h"
 
 Application::Application() = default;
-Application::~Application() = default;
+
+Application::Application(const CoeffsFileParams& coeffsParams) :
+    _minFreqLvl(coeffsParams.minFreqLvl),
+    _maxFreqLvl(coeffsParams.maxFreqLvl),
+    _maxAnisoLvl(coeffsParams.maxAnisoLvl),
+    _integralGridRes(coeffsParams.integralGridRes),
+    _coeffsIntegration(coeffsParams.integration),
+    _coeffSnapSize(coeffsParams.coeffSnapSize),
+    _headless(true)
+{
+}
+
+Application::~Application()
+{
+    StopLazyCoeffs();
+}
 
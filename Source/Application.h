@@ -7,6 +7,10 @@
 #include "VectorField2D.h"
 #include "GridData2D.h"
 #include "BasisFlows.h"
+#include "CoeffsFile.h"
+#include "NeighborLists.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
 
 #define GLM_FORCE_RADIANS
 #include <GL/glew.h>
@@ -15,6 +19,9 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
 #include <vector>
 
 class Obstacle;
@@ -24,6 +31,18 @@ class VelocityArrowShaderPipeline;
 
 enum class ObstacleType { None, Circle, Bar };
 
+// Iterative solvers for B^T.B systems, see Application::InverseBBMatrix
+enum class MatBBSolver { GaussSeidel, ConjugateGradient };
+
+// Preconditioners of MatBBSolver::ConjugateGradient. Jacobi divides by the diagonal. FreqLvlBlocks
+// approximately inverts the block of each frequency level with a symmetric Gauss-Seidel sweep,
+// ignoring the coupling between levels.
+enum class MatBBPreconditioner { Jacobi, FreqLvlBlocks };
+
+// Precision of the vectors of the B^T.B solves of the simulation. float halves the memory traffic
+// of the sweeps; double gives reference solutions, see Application::BenchmarkSolverPrecision.
+typedef float MatBBReal;
+
 // Global class to manage program execution
 class Application {
 
@@ -47,6 +66,13 @@ public:
     const int _minAnisoLvl = 0;
     const int _maxAnisoLvl = 1; // MAXIMUM 2, OTHER BASES ARE NOT DEFINED
 
+    // Start simulating with the frequency levels whose x and y levels are at most
+    // _lazyCoeffsInitialFreqLvl, and compute the coefficients of finer levels in the background.
+    // Finer levels are enabled one at a time, by increasing wavenumber, as their coefficients are
+    // ready. Shortens the time to the first frame.
+    const bool _lazyCoeffs = false;
+    const int _lazyCoeffsInitialFreqLvl = 1;
+
     //
     // Simulation parameters
     //
@@ -54,6 +80,28 @@ public:
     // nb iterations to project forces
     const uint _maxNbItMatBBInversion = 10;
 
+    // Projections stop iterating once the residual norm falls below this fraction of the norm of
+    // the right-hand side. 0 always runs _maxNbItMatBBInversion iterations.
+    const double _matBBInversionTolerance = 0.;
+
+    // Projections start from the solution of the previous frame instead of zero, which is close to
+    // the new one when forces and obstacles move smoothly. Only useful with a tolerance above.
+    const bool _warmStartMatBBInversion = false;
+
+    // solver used by the projections, and its preconditioner
+    const MatBBSolver _matBBSolver = MatBBSolver::GaussSeidel;
+    const MatBBPreconditioner _matBBPreconditioner = MatBBPreconditioner::Jacobi;
+
+    // conjugate gradient iterations between recomputations of the residual
+    const uint _nbItCGResidualReplacement = 50;
+
+    // print the iterations and residual of each projection
+    const bool _printSolverStats = false;
+
+    // minimum number of rows per thread when sweeping an orthogonal group in parallel. Shorter
+    // groups are swept by fewer threads.
+    const int _minRowsPerSolverTask = 64;
+
     // nb iterations when computing basis stretches
     const uint _nbStretchLoops = 2;
 
@@ -135,6 +183,15 @@ public:
     // multiplicator for projected flow around moving obstacles
     const float _obstacleBoundaryFactor = 3.f;
 
+    // Basis flows whose coefficient and boundary coefficient are both below this magnitude sleep
+    // unless a neighbor above it sends them transport or energy, see UpdateAwakeBasisSets. Sleeping
+    // basis flows are skipped by basis advection and keep their coefficients, and particle advection
+    // and display skip them too. 0 never puts basis flows to sleep.
+    const float _sleepingCoeffThreshold = 0.f;
+
+    // print the fraction of simulated basis flows that are awake at each step
+    const bool _printSleepingStats = false;
+
     // simulation domain
     const glm::vec2 _domainCenter = { 0,0 };
     const glm::vec2 _domainHalfSize = { 1.f,1.f };
@@ -150,12 +207,9 @@ public:
     // obstacle marching squares
     const unsigned int _obstacleDisplayRes = 256;
 
-    // grid to integrate basis when computing coefficients
+    // grid to integrate basis when computing coefficients with CoeffsIntegration::Trapezoid
     const unsigned int _integralGridRes = 32 - 1;
 
-    // acceleration structure for basis centers
-    const unsigned int _accelBasisRes = 32;
-
     // particle acceleration structure
     const unsigned int _accelParticlesRes = 64;
 
@@ -177,11 +231,21 @@ public:
     bool _moveObstacles = true;
     bool _stepSimulation = true;
 
+    // run the benchmarks of Benchmarks.cpp after initialization
+    const bool _runBenchmarks = false;
+
     //================================================
 
+    // Integration of BB and T coefficients. Analytic is exact, Trapezoid uses a grid of
+    // _integralGridRes cells on the basis templates.
+    const CoeffsIntegration _coeffsIntegration = CoeffsIntegration::Analytic;
+
     // Size of grid to snap basis centers when saving coefficient dictionary to avoid float errors
     const float _coeffSnapSize = _lengthLvl0 / float(1 << _maxFreqLvl) / 32.0f;
 
+    // No OpenGL context, data buffers only have CPU storage. Set by the coefficient baker.
+    const bool _headless = false;
+
     const float _domainLeft = _domainCenter.x - _domainHalfSize.x;
     const float _domainRight = _domainCenter.x + _domainHalfSize.x;
     const float _domainBottom = _domainCenter.y - _domainHalfSize.y;
@@ -189,6 +253,9 @@ public:
 
 public:
     Application();
+    // Headless application that only computes coefficient dictionaries, see CoeffBaker.cpp. Uses
+    // the dictionary parameters of coeffsParams instead of the ones above.
+    explicit Application(const CoeffsFileParams& coeffsParams);
     ~Application();
 
     // Main loop
@@ -197,6 +264,7 @@ public:
     // Initialization calls, return false if failed
     bool Init();
     bool Init_DataBuffers();
+    bool Init_BasisFlowBuffers();
     bool Init_Obstacles();
     bool Init_BasisFlows();
     bool Init_Shaders();
@@ -225,26 +293,183 @@ public:
     glm::vec2 MatTCoeff(int iTransported, int iTransporting);
     glm::vec2 MatTCoeff(BasisFlow bTransported, BasisFlow bTransporting);
 
+    // Compute the dictionary key of a coefficient, and the basis flows relative to the lowest common
+    // frequency level that are integrated to compute it. baseFreq is the scaling of T coefficients.
+    // Return false if the basis supports do not intersect, in which case the coefficient is zero.
+    // Keys are canonical among the pairs related by basis symmetries, and the relative basis flows
+    // are those of the canonical pair. T coefficients of the canonical pair are mapped back to the
+    // queried pair with symmetry.
+    bool CoeffKeyBB(const BasisFlow& b1, const BasisFlow& b2,
+        KeyTypeBB& key, BasisFlow& bRelative1, BasisFlow& bRelative2);
+    bool CoeffKeyT(const BasisFlow& bTransported, const BasisFlow& bTransporting,
+        KeyTypeT& key, BasisFlow& bRelativeTransported, BasisFlow& bRelativeTransporting, float& baseFreq,
+        CoeffTSymmetry& symmetry);
+
+    // Look up a coefficient in the dictionaries. Return false if it has not been computed yet.
+    bool FindCoeffBB(const KeyTypeBB& key, float& coeff);
+    bool FindCoeffT(const KeyTypeT& key, glm::vec2& coeff);
+
+    // Compute, on all cores, the coefficients of all pairs of intersecting basis flows that are
+    // missing from the dictionaries. Afterwards, MatBBCoeff and MatTCoeff only read the dictionaries
+    // for these pairs and can be called concurrently.
+    // bases: basis flows, in the same order as _basisFlowParams
+    // nbActiveBasisFlows: only pairs of bases with indices below nbActiveBasisFlows are considered
+    void PrecomputeCoeffsBB(const BasisFlow* bases, unsigned int nbActiveBasisFlows);
+    void PrecomputeCoeffsT(const BasisFlow* bases, unsigned int nbActiveBasisFlows);
+
+    // Lazy coefficient generation, see _lazyCoeffs.
+    // StartLazyCoeffs: starts computing the coefficients of inactive frequency levels in the background
+    // UpdateLazyCoeffs: enables the levels whose coefficients are ready. Called on each simulation step.
+    // WaitLazyCoeffs: waits for all coefficients and enables all levels
+    // StopLazyCoeffs: stops the background computation as soon as possible
+    void StartLazyCoeffs();
+    void LazyCoeffsWorker(std::vector<BasisFlow> bases, unsigned int nbActiveFreqLvls);
+    void UpdateLazyCoeffs();
+    void WaitLazyCoeffs();
+    void StopLazyCoeffs();
+
     // Solves B^T.B.vecX = vecB for vecX, only using the basis flows that have all bits basisBitMask
     // turned on. This is used to project forces onto the basis (where boundary basis flows are ignored)
     // or to project a moving obstacle's motion onto the boundary bases (in which cases nly boundary
     // basis flows are used).
-    // Uses Gauss-Seidel iterations. Since basis flows are ordered by wavenumber, doing only one step of
-    // Gauss-Seidel is equivalent to projection frequency layers independently.
-    void InverseBBMatrix(
-        DataBuffer1D<double>* vecX,
-        DataBuffer1D<double>* vecB,
+    // Uses Gauss-Seidel iterations by default. Since basis flows are ordered by wavenumber, doing only
+    // one step of Gauss-Seidel is equivalent to projection frequency layers independently.
+    // Stops early when the residual is below the tolerance, and returns immediately if the
+    // right-hand side of the basis flows used is zero. vecX holds the initial guess with warm start.
+    // The first version uses the solver parameters above.
+    struct SolverSettings {
+        MatBBSolver solver;
+        MatBBPreconditioner preconditioner;
+        unsigned int maxNbIterations;
+        double tolerance;
+        bool warmStart;
+    };
+    struct SolverStats {
+        unsigned int nbIterations = 0;
+        // residual norm measured during the last iteration, relative to the right-hand side
+        double relativeResidual = 0.;
+    };
+    // The solves are templated on the precision Real of their vectors, float or double, which is
+    // used for all the arithmetic on them. Norms and dot products are accumulated in double.
+    // The simulation uses MatBBReal.
+    template <class Real>
+    SolverStats InverseBBMatrix(
+        DataBuffer1D<Real>* vecX,
+        DataBuffer1D<Real>* vecB,
         unsigned int basisBitMask);
-    void InverseBBMatrixMain(
-        unsigned int iRow, double* vecX, double* vecB,
-        BasisFlow* basisDataPointer, unsigned int basisBitMask);
+    template <class Real>
+    SolverStats InverseBBMatrix(
+        DataBuffer1D<Real>* vecX,
+        DataBuffer1D<Real>* vecB,
+        unsigned int basisBitMask,
+        const SolverSettings& settings);
+    // Zeroes x (outside of the basis flows used, or everywhere without warm start) and the residual
+    // before a solve, and returns the squared norm of the right-hand side over the basis flows used.
+    // If it is zero, x is zero everywhere, which is the solution.
+    template <class Real>
+    double InitBBSystem(
+        Real* vecX, const Real* vecB, Real* vecResidual, unsigned int basisBitMask, bool warmStart);
+    // One system of InverseBBMatrices
+    template <class Real>
+    struct MatBBSystem {
+        DataBuffer1D<Real>* vecX;
+        DataBuffer1D<Real>* vecB;
+        unsigned int basisBitMask;
+        SolverStats stats; // set by InverseBBMatrices
+    };
+    // Solves several systems sharing B^T.B, with the solver parameters above. With Gauss-Seidel, the
+    // systems are swept together on their BatchedBasisSet, so that the rows they share are read once
+    // for all of them and each orthogonal group is dispatched to the solver threads once. The results
+    // are the same as solving them one after the other, which other solvers do.
+    static const unsigned int MAX_NB_BATCHED_BB_SYSTEMS = 4;
+    template <class Real>
+    void InverseBBMatrices(MatBBSystem<Real>* systems, unsigned int nbSystems);
+    struct BatchedBasisSet;
+    // Updates row iRow of the systems of systemMask in a batch of InverseBBMatrices. Each system
+    // follows the operations of InverseBBMatrixMain, so the results are those of separate solves.
+    template <unsigned int NbSystems, class Real>
+    void InverseBBMatricesMain(
+        unsigned int iRow, unsigned int systemMask, const BatchedBasisSet& basisSet,
+        Real* const* vecX, const Real* const* vecB, Real* const* vecResidual, BasisFlow* basisDataPointer);
+    // Updates row iRow, whose neighbors used are those of neighbors (see MaskedBasisSet::bb), and
+    // returns its residual before the update
+    template <class Real>
+    Real InverseBBMatrixMain(
+        unsigned int iRow, Real* vecX, const Real* vecB,
+        BasisFlow* basisDataPointer, const NeighborCoeffs<float>& neighbors);
+    // Sum of the coefficients of a row of neighbors times the entries of vecX they point to, using
+    // the gather kernel of the precision of vecX
+    float GatherBBRow(unsigned int iRow, const NeighborCoeffs<float>& neighbors, const float* vecX);
+    double GatherBBRow(unsigned int iRow, const NeighborCoeffs<float>& neighbors, const double* vecX);
+    // Conjugate gradient iterations of InverseBBMatrix. vecX and vecB are zero outside of the
+    // basis flows used, which the matrix products rely on.
+    template <class Real>
+    SolverStats InverseBBMatrixCG(
+        Real* vecX, const Real* vecB, unsigned int basisBitMask,
+        const SolverSettings& settings, double normSquaredB);
+    // vecY = B^T.B.vecX, restricted to the basis flows used. vecX must be zero outside of them.
+    template <class Real>
+    void MultiplyBBMatrix(const Real* vecX, Real* vecY, unsigned int basisBitMask);
+    // vecZ = M^-1.vecR for the preconditioner M
+    template <class Real>
+    void ApplyBBPreconditioner(
+        const Real* vecR, Real* vecZ, unsigned int basisBitMask, MatBBPreconditioner preconditioner);
+
+    // Scratch vectors of the solves in precision Real, sized to the number of basis flows on first use
+    template <class Real>
+    struct MatBBWorkspace {
+        std::vector<Real> residual;
+        // residuals of the systems of InverseBBMatrices, one after the other
+        std::vector<Real> residualsBatched;
+        // conjugate gradient search direction, its product with B^T.B, preconditioned residual,
+        // and iterate with the lowest residual
+        std::vector<Real> cgDirection;
+        std::vector<Real> cgProduct;
+        std::vector<Real> cgPreconditioned;
+        std::vector<Real> cgBest;
+    };
+    template <class Real>
+    MatBBWorkspace<Real>& GetMatBBWorkspace();
 
-    // Saves/loads the coefficient dictionaries to/from file
+    // Saves/loads the coefficient dictionaries to/from text file
     void SaveCoeffsBB(std::string filename);
     void LoadCoeffsBB(std::string filename);
     void SaveCoeffsT(std::string filename);
     void LoadCoeffsT(std::string filename);
 
+    // Maps binary coefficient dictionaries (see CoeffsFile.h), which are then queried in place by
+    // MatBBCoeff and MatTCoeff. Returns false if the file is missing or was made with other parameters.
+    bool MapCoeffsFileBB(std::string filename);
+    bool MapCoeffsFileT(std::string filename);
+
+    // Writes the mapped and newly computed coefficients to a binary dictionary, and maps it instead
+    // of the previous one. Does nothing if no new coefficient was computed.
+    void SaveCoeffsFileBB(std::string filename);
+    void SaveCoeffsFileT(std::string filename);
+
+    // Name of the dictionary file of type "BB" or "T" for the current frequency parameters
+    std::string CoeffsFilename(std::string coeffType, std::string extension);
+
+    // Parameters recorded in binary dictionary headers
+    CoeffsFileParams CoeffsParams();
+
+    // Tells why an existing dictionary file is not used, if it was made with other parameters
+    void PrintCoeffsFileMismatch(std::string filename, CoeffsFileKind kind);
+
+    // Snapshot of the state set up by Init_BasisFlows: basis flows, basis groups, intersection lists
+    // and decompressed coefficients. Restoring it skips the basis setup on later runs.
+    // BasisSnapshotHash: hash of all parameters the snapshot depends on, including the static obstacles
+    // BasisSnapshotFilename: name of the snapshot file, which contains the hash
+    // LoadBasisSnapshot: returns false, leaving the basis setup untouched, if the file is missing or invalid
+    uint64_t BasisSnapshotHash();
+    std::string BasisSnapshotFilename();
+    void SaveBasisSnapshot(std::string filename);
+    bool LoadBasisSnapshot(std::string filename);
+
+    // Resizes the vectors of the B^T.B solver and _basisCoeffs to the number of basis flows, with
+    // all coefficients set to zero
+    void SetupBasisFlowBuffers();
+
     // Evaluates a basis at a given point from its basis template (i.e. scaling and translating the
     // basis template to the right frequency level and center)
     // p: point to evaluate
@@ -252,16 +477,23 @@ public:
     // center: center of the basis
     glm::vec2 TranslatedBasisEval(const glm::vec2 p, const glm::ivec2 freqLvl, const glm::vec2 center);
 
-    // Computes \int(b1.b2), see Equation 1.
+    // Computes \int(b1.b2), see Equation 1, with the method of _coeffsIntegration.
     float IntegrateBasisBasis(BasisFlow b1, BasisFlow b2);
 
+    // Computes \int(b1.b2) with the trapezoid rule on the basis templates.
+    float IntegrateBasisBasisTrapezoid(BasisFlow b1, BasisFlow b2);
+
     // Computes \int(b.vecField), where velField is a vector field defined on the simulation domain.
     float IntegrateBasisGrid(BasisFlow& b, VectorField2D* velField);
 
     // Computes basis flow's average on its support, i.e.
-    // \int_{S}(bVec)/\int_{S}, where S is bSupport's support. See Equation 18.
+    // \int_{S}(bVec)/\int_{S}, where S is bSupport's support. See Equation 18. Uses the method of
+    // _coeffsIntegration.
     glm::vec2 AverageBasisOnSupport(BasisFlow bVec, BasisFlow bSupport);
 
+    // Computes AverageBasisOnSupport with the trapezoid rule on the basis templates.
+    glm::vec2 AverageBasisOnSupportTrapezoid(BasisFlow bVec, BasisFlow bSupport);
+
     // Computes the stretch of a given basis flow, see Section 6.1. If staticObstaclesOnly is true,
     // only static obstacles will be used. During initialization, we need to excluse dynamic obstacles
     // otherwise basis flows that are not used during the first frame could become used in later frames
@@ -269,13 +501,14 @@ public:
     // are accounted for when precomputing interaction coefficients.
     BasisFlow ComputeStretch(BasisFlow b, bool staticObstaclesOnly);
     
-    // Compute stretches for all basis flows
+    // Compute stretches and flags of all basis flows, and save the flags in stretchBitFlags
     void ComputeStretches();
 
     // Evaluates a stretched basis flow at point p, weighted by the basis's coefficient.
     // p: evaluatiom point
     // b: stretched basis
-    vec2 VecObstacle_stretch(vec2 p, BasisFlow const& b);
+    // coeff: coefficient of b, see _basisCoeffs
+    vec2 VecObstacle_stretch(vec2 p, BasisFlow const& b, float coeff);
 
     // Uses Newton iterations to inverse the bilinear coefficients for stretched coordinates,
     // going from stretched world space (p) to unstretched UV space. Based on
@@ -294,25 +527,108 @@ public:
     // Adds new particles
     void SeedParticles();
 
-    // Projects all buoyancy forces from particles onto the basis flows. Splats particle buoyancy
-    // on a grid, and projects forces from that grid to the basis flows.
+    // Projects dynamic obstacle motion onto the boundary basis flows (see Section 6.2 and
+    // ComputeDynamicObstacleBoundaryMotionRHS) and, with _useForcesFromParticles, particle buoyancy
+    // onto the interior basis flows (see ComputeParticleForcesRHS). Both right-hand sides only depend
+    // on the state before advection, so both systems are solved in one batched solve. Sets the
+    // boundary coefficients; the forces are added after advection by AddParticleForcesToBasisFlows.
+    void ProjectForcesAndBoundaryMotion();
+
+    // Splats particle buoyancy on a grid, and integrates it against the basis flows used for forces
+    // in _vecBForces
+    void ComputeParticleForcesRHS();
+
+    // Adds the projected particle forces to the basis flow coefficients
     void AddParticleForcesToBasisFlows();
 
-    // Projects dynamic obsacle motion onto boundary basis flows. See Secton 6.2 .
-    void ProjectDynamicObstacleBoundaryMotion();
+    // Integrates dynamic obstacle motion against the boundary basis flows in _vecB
+    void ComputeDynamicObstacleBoundaryMotionRHS();
 
     // Computes blinear weights for basis advection. See Equation 20.
-    // newCenter: position where basis bi is being moved
-    // bi: basis being moved
-    // bj: one basis on a corner of the cell where newCenter lands, which will receive part of
-    // bi's contribution
-    void ComputeNewCenterProportions(vec2& newCenter, BasisFlow& bi, BasisFlow& bj, vec2& interBasisDist);
+    // newCenter: position where a basis is being moved
+    // bj: one basis on a corner of the cell where newCenter lands, which receives the returned
+    // fraction of the moved basis's coefficient
+    float NewCenterProportion(const vec2& newCenter, const BasisFlow& bj, const vec2& interBasisDist);
     
-    // Compute all basis flows advection
+    // Compute all basis flows advection. Transport and energy transfer run in parallel: each basis
+    // flow first computes what it sends to each of its neighbors, then each basis flow gathers what
+    // it receives, adding it up by increasing sender id. The result is the same for any number of
+    // threads, and the same as scattering the contributions one basis flow after the other.
     void ComputeBasisAdvection();
 
+    // Rebuilds _awakeBasisIds from the coefficients at the start of basis advection. Basis flows
+    // above _sleepingCoeffThreshold, the basis flows they transport to and the basis flows those
+    // transfer energy to may be above the threshold during the step, so they send transport and
+    // energy. The basis flows they send to are awake too, but only receive: they keep their own
+    // coefficient, so that nothing sent is lost and nothing is moved by a sleeping basis flow.
+    void UpdateAwakeBasisSets();
+
+    // fraction of the simulated basis flows that were awake during the last basis advection
+    float AwakeBasisFraction() const {
+        return _simulatedBasisIds.empty() ? 1.f : float(_awakeBasisIds.size()) / float(_simulatedBasisIds.size());
+    }
+
+    // true for the simulated basis flows that slept during the last basis advection
+    bool Sleeping(unsigned int i) const {
+        return i < _awakeBasisFlags.size() && _simulatedBasisFlags[i] && !_awakeBasisFlags[i];
+    }
+
+    // Rebuild the transposed lists of transport (and the transport stencils) and of energy transfer if
+    // _incomingTransportEntriesNeedUpdating or _incomingDeformationEntriesNeedUpdating is set
+    void UpdateIncomingTransportEntries();
+    void UpdateIncomingDeformationEntries();
+
+    // Runs all benchmarks and prints their timings
+    void RunBenchmarks();
+    // Calls function(nbThreads) with _solverThreadPool replaced by a pool of nbThreads threads, for
+    // 1 to all hardware threads in powers of two, then restores the pool
+    template <class Function>
+    void ForEachThreadCount(Function function);
+    // Sets basisBitMask in the flags of the active basis flows and clears the flags of the others, as
+    // if forces and boundaries covered the domain. Returns the previous flags.
+    std::vector<unsigned int> ForceBasisBitFlags(unsigned int basisBitMask);
+    // Restores the flags returned by ForceBasisBitFlags
+    void RestoreBasisBitFlags(const std::vector<unsigned int>& savedBitFlags);
+
+    // Compares loading the coefficient dictionaries from text files and from binary files
+    void BenchmarkCoeffsLoading();
+
+    // Measures MatBBCoeff and MatTCoeff throughput, and compares lookups in the packed-key hash
+    // tables with lookups in the previous tuple-keyed std::unordered_map
+    void BenchmarkCoeffsLookup();
+
+    // Compares the speed of analytic and trapezoid integration of BB and T coefficients, and
+    // their differences
+    void BenchmarkCoeffsIntegration();
+
+    // Compares the memory footprint and sweep time of the CSR neighbor lists with one vector of
+    // neighbors per basis
+    void BenchmarkNeighborLists();
+
+    // Times the force and boundary projections (see InverseBBMatrix) with 1 to all hardware threads
+    void BenchmarkSolverScaling();
+
+    // Compares the time Gauss-Seidel and preconditioned conjugate gradients take to reach given
+    // residuals when projecting a smooth field
+    void BenchmarkMatBBSolvers();
+
+    // Times the force and boundary projections solved separately and batched (see InverseBBMatrices)
+    void BenchmarkBatchedMatBBSolve();
+
+    // Times the gather kernels of each instruction set supported on all rows of B^T.B and T
+    void BenchmarkSimdKernels();
+
+    // Times the projections solved in float and in double precision, and compares their solutions
+    void BenchmarkSolverPrecision();
+
+    // Times basis advection with 1 to all hardware threads, and checks that results do not change
+    void BenchmarkAdvectionScaling();
+
+    // Times basis advection and energy transfer per step, and counts their sweeps over the basis flows
+    void BenchmarkBasisDynamics();
+
     // Computed wavenumber from the basis flow's frequency. See Section 5.3 .
-    inline float WavenumberBasis(BasisFlow& b)
+    inline float WavenumberBasis(const BasisFlow& b)
     {
         return powf(2.f, 0.5f*(b.freqLvl.x + b.freqLvl.y));
     }
@@ -337,6 +653,7 @@ public:
     std::unique_ptr<VectorField2D> _forceField = nullptr;
     std::unique_ptr<VectorField2D>* _basisFlowTemplates = nullptr;
     std::unique_ptr<DataBuffer1D<BasisFlow>> _basisFlowParams = nullptr;
+    BasisCoeffs _basisCoeffs; // coefficients of the basis flows of _basisFlowParams
     std::vector<ivec2> _freqLvls;
 
     // particles buffers
@@ -353,27 +670,75 @@ public:
     std::unique_ptr<DataBuffer1D<vec2>> _obstacleLines = nullptr;
 
     // force projection buffers
-    std::unique_ptr<DataBuffer1D<double>> _vecX = nullptr;
-    std::unique_ptr<DataBuffer1D<double>> _vecXForces = nullptr;
-    std::unique_ptr<DataBuffer1D<double>> _vecXBoundaryForces = nullptr;
-    std::unique_ptr<DataBuffer1D<double>> _vecB = nullptr;
+    std::unique_ptr<DataBuffer1D<MatBBReal>> _vecX = nullptr;
+    std::unique_ptr<DataBuffer1D<MatBBReal>> _vecXForces = nullptr;
+    std::unique_ptr<DataBuffer1D<MatBBReal>> _vecXBoundaryForces = nullptr;
+    std::unique_ptr<DataBuffer1D<MatBBReal>> _vecB = nullptr;
+    std::unique_ptr<DataBuffer1D<MatBBReal>> _vecBForces = nullptr;
+
+    MatBBWorkspace<float> _matBBWorkspaceFloat;
+    MatBBWorkspace<double> _matBBWorkspaceDouble;
 
-    // acceleration structure to fetch basis flows that intersect a region of the simulation domain
-    std::unique_ptr<DataBuffer2D<std::vector<unsigned int>*>> _accelBasisCentersIds = nullptr;
+    // gather kernels of the solver and advection rows, for the best instruction set of the CPU
+    SimdKernels _simdKernels = GetSimdKernels(DetectSimdLevel());
+
+    // coeff + _obstacleBoundaryFactor * coeffBoundary of each basis flow, gathered by the
+    // transport rows of ComputeBasisAdvection
+    std::vector<float> _basisVelocityWeights;
+    // energy transfer rate of each basis flow for one substep of ComputeBasisAdvection, which only
+    // depends on its frequency. Set with the transposed energy transfer lists.
+    std::vector<float> _basisTransferRates;
+
+    // threads sweeping the orthogonal groups in InverseBBMatrix, also used by basis advection
+    std::unique_ptr<ThreadPool> _solverThreadPool = nullptr;
+
+    // lattice of basis centers of each frequency level, in the same order as _freqLvls
+    std::vector<BasisLattice> _basisLattices;
 
     // Stores, for all basis flows, the ID of all beighboring basis flows.
-    std::unique_ptr<DataBuffer1D<std::vector<unsigned int>*>> _intersectingBasesIds = nullptr;
+    NeighborIds _intersectingBasesIds;
 
     // Stores, for all basis flows, the ID of all neighboring basis flows of the same frequency.
     // This is used during basis transport. Since a basis will usually transported near its
     // current location, e only need to look at neighboring basis flows of the same frequencies
     // to transfer its weight.
-    std::unique_ptr<DataBuffer1D<std::vector<unsigned int>*>> _intersectingBasesIdsTransport = nullptr;
+    NeighborIds _intersectingBasesIdsTransport;
+
+    // Transposed transport lists: row j holds the positions in _intersectingBasesIdsTransport.ids of
+    // the entries equal to j, in increasing order, so by increasing sender. Lets basis advection
+    // gather the contributions each basis flow receives.
+    NeighborIds _incomingTransportEntries;
+    // basis flow whose transport row holds each entry of _intersectingBasesIdsTransport
+    std::vector<unsigned int> _transportEntrySources;
+
+    // index of each basis flow in the lattice of its frequency level, see _basisLattices
+    std::vector<glm::ivec2> _basisLatticeIndices;
+    // Transport stencils: for each basis flow, 9 entries giving, for the lattice offsets (dx, dy) in
+    // [-1,1]^2 at index 3 * (dy + 1) + dx + 1, the entry of its transport row holding the basis
+    // flow at that offset, or -1. A basis flow moved by less than a lattice spacing lands in a
+    // lattice cell whose four corners are among these offsets.
+    std::vector<int> _transportStencilEntries;
+
+    // Contributions of basis advection to the transport neighbors of each basis flow, one per entry
+    // of _intersectingBasesIdsTransport
+    std::vector<float> _transportContributions;
+    // Contributions of basis flows moved beyond their transport neighbors, whose targets are found in
+    // the lattice of their frequency level instead. Sorted by target, then by source.
+    struct FarTransportContribution {
+        unsigned int target;
+        unsigned int source;
+        float coeff;
+    };
+    std::vector<FarTransportContribution> _farTransportContributions;
+    // How each basis flow was advected during the current step, see TRANSPORT_MODES in Dynamics.cpp.
+    // Only set for simulated basis flows.
+    std::vector<unsigned char> _transportModes;
+    // new center of each advected basis flow
+    std::vector<vec2> _transportNewCenters;
     
     // Stores, for all basis flows, the B^T.B coefficient of all neighboring basis flows. This is
     // used during energy transfer in Equation 24.
-    std::unique_ptr<DataBuffer1D<std::vector<CoeffBBDecompressedIntersectionInfo>*>>
-        _intersectingBasesIdsDeformation[_nbExplicitTransferFreqs];
+    NeighborCoeffs<float> _intersectingBasesIdsDeformation[_nbExplicitTransferFreqs];
 
     struct ExplicitTransferCoeffs {
         float coeffs[_nbExplicitTransferFreqs];
@@ -381,6 +746,16 @@ public:
     // total contribution of beighboring basis, see denominator of Equation 24
     std::vector<ExplicitTransferCoeffs> _coeffBBExplicitTransferSum_abs;
 
+    // Transposed energy transfer lists: row j holds the entries of _intersectingBasesIdsDeformation
+    // whose neighbor is j, by increasing sender, then relative frequency, then position. Entries of
+    // relative frequency r are numbered from _deformationEntryOffsets[r].
+    NeighborIds _incomingDeformationEntries;
+    std::vector<unsigned int> _deformationEntryOffsets;
+    // basis flow whose transfer row holds each entry
+    std::vector<unsigned int> _deformationEntrySources;
+    // energy sent along each entry during the current substep of energy transfer
+    std::vector<float> _deformationContributions;
+
     // list of all obstacles, inclusing simulation domain walls
     std::vector<Obstacle*> _obstacles;
 
@@ -388,9 +763,12 @@ public:
     // with the multicolor scheme, see Section 5.1 .
     std::vector<std::vector<unsigned int>> _orthogonalBasisGroupIds;
 
-    // coefficient dictionaries
+    // coefficient dictionaries. Coefficients are looked up in the maps first, which hold coefficients
+    // loaded from text files or computed since the binary dictionaries were mapped.
     MapTypeBB _coeffsBB;
     MapTypeT _coeffsT;
+    CoeffsFileMapping _coeffsBBFile;
+    CoeffsFileMapping _coeffsTFile;
 
     // Instead of evaluating the coefficient dictionaries, we store, for each basis, the list of it's
     // neighboring coefficients and corresponding interaction coefficients. See last paragraph of
@@ -398,9 +776,116 @@ public:
     // neihbors, since we do not need it when inverting the B^T.B matrix. The B^T.B coefficient of a 
     // basis with itself is also already stored in the basis's normSquared field. For the
     // decopressed T coefficient, the basis itself is inclused in the list, since we need to account
-    // for self advection when computing basis advection.
-    std::vector<std::vector<CoeffBBDecompressedIntersectionInfo>> _coeffsBBDecompressedIntersections;
-    std::vector<std::vector<CoeffTDecompressedIntersectionInfo>>  _coeffsTDecompressedIntersections;
+    // for self advection when computing basis advection. All lists are stored in CSR format, see
+    // NeighborLists.h .
+    NeighborCoeffs<float> _coeffsBBDecompressedIntersections;
+    NeighborCoeffs<glm::vec2> _coeffsTDecompressedIntersections;
+
+    // Basis flows selected by a mask of BASIS_FLAGS, and their B^T.B coefficients restricted to
+    // neighbors the mask also selects, in the order of _coeffsBBDecompressedIntersections. Lets the
+    // masked solves loop over the rows and neighbors they use without testing flags.
+    struct MaskedBasisSet {
+        unsigned int basisBitMask;
+        // selected basis flows of each orthogonal group of _orthogonalBasisGroupIds
+        std::vector<std::vector<unsigned int>> groupIds;
+        // rows of unselected basis flows are empty
+        NeighborCoeffs<float> bb;
+        // 1 for selected basis flows
+        std::vector<unsigned char> selected;
+        // false once flags changed, until the selection is checked again
+        bool upToDate = false;
+    };
+
+    // Returns the set of basis flows selected by basisBitMask. After _activeBasisSetsNeedUpdating is
+    // set, the first request checks the selection against the current flags, and rebuilds the set
+    // only if it changed.
+    const MaskedBasisSet& GetMaskedBasisSet(unsigned int basisBitMask);
+
+    // Basis flows selected by the masks of the systems of an InverseBBMatrices batch. A row that all
+    // its systems restrict to the same neighbors is shared: the row of the first of them is read from
+    // memory once and gathered from for all of them.
+    struct BatchedBasisSet {
+        std::vector<unsigned int> basisBitMasks;
+        // MaskedBasisSet of each system
+        std::vector<const MaskedBasisSet*> systemSets;
+        // basis flows selected by any mask in each orthogonal group of _orthogonalBasisGroupIds
+        std::vector<std::vector<unsigned int>> groupIds;
+        // bit s set for the basis flows the mask of system s selects
+        std::vector<unsigned char> rowSystems;
+        // 1 for shared rows
+        std::vector<unsigned char> sharedRows;
+        // false once flags changed, until the selections are checked again
+        bool upToDate = false;
+    };
+
+    // Returns the set of the given masks, kept up to date as in GetMaskedBasisSet
+    const BatchedBasisSet& GetBatchedBasisSet(const unsigned int* basisBitMasks, unsigned int nbSystems);
+
+    // Rebuilds _simulatedBasisIds and _simulatedBasisFlags, and marks the masked sets for checking if
+    // _activeBasisSetsNeedUpdating is set
+    void UpdateActiveBasisSets();
+
+    std::vector<std::unique_ptr<MaskedBasisSet>> _maskedBasisSets;
+    std::vector<std::unique_ptr<BatchedBasisSet>> _batchedBasisSets;
+
+    // basis flows with the INTERIOR or DYNAMIC_BOUNDARY_PROJECTION flag, which are advected
+    std::vector<unsigned int> _simulatedBasisIds;
+    // 1 for the basis flows of _simulatedBasisIds
+    std::vector<unsigned char> _simulatedBasisFlags;
+
+    // Simulated basis flows that are not sleeping during the current basis advection, by increasing
+    // id, followed by the sleeping basis flows woken by far transport. See UpdateAwakeBasisSets.
+    std::vector<unsigned int> _awakeBasisIds;
+    // 1 for the basis flows of _awakeBasisIds
+    std::vector<unsigned char> _awakeBasisFlags;
+    // 1 for the simulated basis flows above _sleepingCoeffThreshold, for those and the basis flows
+    // they transport to, and for the basis flows that send transport and energy, computed by
+    // UpdateAwakeBasisSets
+    std::vector<unsigned char> _activeBasisFlags;
+    std::vector<unsigned char> _transportedBasisFlags;
+    std::vector<unsigned char> _sendingBasisFlags;
+
+    // Sweeps of the last ComputeBasisAdvection over all basis flows, over the simulated basis flows
+    // and over the awake basis flows, counted where each sweep is made. Only reported by
+    // BenchmarkBasisDynamics.
+    struct BasisDynamicsSweeps {
+        unsigned int all = 0;
+        unsigned int simulated = 0;
+        unsigned int awake = 0;
+    };
+    BasisDynamicsSweeps _basisDynamicsSweeps;
+
+    // Decompressed coefficients of all neighbors of each basis flow. Used in the simulation instead
+    // of the dictionaries, see _coeffsBBDecompressedIntersections.
+    struct DecompressedCoeffs {
+        NeighborCoeffs<float> bb;
+        NeighborCoeffs<glm::vec2> t;
+        NeighborCoeffs<float> deformation[_nbExplicitTransferFreqs];
+        std::vector<ExplicitTransferCoeffs> explicitTransferSum_abs;
+    };
+
+    // Fills coeffs from the dictionaries. Only bases with indices below nbActiveBasisFlows have
+    // neighbors, and only among themselves. Missing coefficients must have been precomputed.
+    void DecompressCoeffs(const BasisFlow* bases, unsigned int nbActiveBasisFlows, DecompressedCoeffs& coeffs);
+
+    // Makes coeffs the decompressed coefficients used in the simulation. coeffs gets the previous ones.
+    void SwapDecompressedCoeffs(DecompressedCoeffs& coeffs);
+
+    // index of the first basis flow of each frequency level of _freqLvls, followed by the number of
+    // basis flows. Bases of a frequency level are contiguous.
+    std::vector<unsigned int> _freqLvlBasisOffsets;
+
+    // Basis flows simulated. Other basis flows have their flags cleared and no neighbors. All basis
+    // flows unless _lazyCoeffs is set and some frequency levels are not ready yet.
+    unsigned int _nbActiveBasisFlows = 0;
+
+    // Lazy coefficient generation. The worker thread publishes decompressed coefficients of a larger
+    // set of active bases in _lazyCoeffsReady, which the simulation thread then swaps in.
+    std::thread _lazyCoeffsThread;
+    std::mutex _lazyCoeffsMutex;
+    std::atomic<bool> _lazyCoeffsStopRequested{ false };
+    std::unique_ptr<DecompressedCoeffs> _lazyCoeffsReady;
+    unsigned int _lazyCoeffsReadyNbActiveBasisFlows = 0;
 
     // shader pipelines
     std::unique_ptr<ObstacleShaderPipeline> _pipelineObstacle;
@@ -415,6 +900,11 @@ public:
     bool _newRCoeffComputed = false;
     bool _obstacleDisplayNeedsUpdating = true;
     bool _basisStretchedUpdateRequired = true;
+    // set whenever the flags of the basis flows or their neighbors change, see GetMaskedBasisSet
+    bool _activeBasisSetsNeedUpdating = true;
+    // set when _intersectingBasesIdsTransport or _intersectingBasesIdsDeformation change
+    bool _incomingTransportEntriesNeedUpdating = true;
+    bool _incomingDeformationEntriesNeedUpdating = true;
     unsigned int _particleCircularSeedId = 0;
     bool _particleSeedBufferLooped = false;
     bool _velocityGridNeedsUpdating = true;
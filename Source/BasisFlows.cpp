@@ -1,15 +1,19 @@
 
 #include "Application.h"
 #include "BasisFlows.h"
+#include "BasisIntegrals.h"
 
 #include "Utils.h"
 
+#include <algorithm>
 #include <set>
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <tuple>
 #include <sstream>
+#include <atomic>
+#include <unordered_set>
 
 using namespace glm;
 using namespace std;
@@ -31,57 +35,614 @@ bool IntersectionInteriorEmpty(const BasisSupport& sup1, const BasisSupport& sup
 }
 
 
-void Application::InverseBBMatrixMain(
-    unsigned int iRow, double* vecX, double* vecB,
-    BasisFlow* basisDataPointer, unsigned int basisBitMask)
+float Application::GatherBBRow(unsigned int iRow, const NeighborCoeffs<float>& neighbors, const float* vecX)
 {
-    float tempX = float(vecB[iRow]);
+    unsigned int rowBegin = neighbors.RowBegin(iRow);
+    return _simdKernels.gatherDot(
+        neighbors.coeffs.data() + rowBegin, neighbors.ids.data() + rowBegin, vecX, neighbors.RowSize(iRow));
+}
 
-    vector<CoeffBBDecompressedIntersectionInfo>& intersectionInfos = _coeffsBBDecompressedIntersections[iRow];
-    for (const CoeffBBDecompressedIntersectionInfo& inter : intersectionInfos) {
-        if (AllBitsSet(basisDataPointer[inter.j].bitFlags, basisBitMask)) {
-            tempX -= inter.coeff * float(vecX[inter.j]);
-        }
+
+double Application::GatherBBRow(unsigned int iRow, const NeighborCoeffs<float>& neighbors, const double* vecX)
+{
+    unsigned int rowBegin = neighbors.RowBegin(iRow);
+    return _simdKernels.gatherDotDouble(
+        neighbors.coeffs.data() + rowBegin, neighbors.ids.data() + rowBegin, vecX, neighbors.RowSize(iRow));
+}
+
+
+template <class Real>
+static Application::MatBBWorkspace<Real>& ResizeMatBBWorkspace(
+    Application::MatBBWorkspace<Real>& workspace, unsigned int nbBasisFlows)
+{
+    if (workspace.residual.size() != nbBasisFlows) {
+        workspace.residual.assign(nbBasisFlows, Real(0));
+        workspace.residualsBatched.assign(size_t(nbBasisFlows) * Application::MAX_NB_BATCHED_BB_SYSTEMS, Real(0));
+        workspace.cgDirection.assign(nbBasisFlows, Real(0));
+        workspace.cgProduct.assign(nbBasisFlows, Real(0));
+        workspace.cgPreconditioned.assign(nbBasisFlows, Real(0));
+        workspace.cgBest.assign(nbBasisFlows, Real(0));
     }
+    return workspace;
+}
 
-    vecX[iRow] = double(tempX / float(basisDataPointer[iRow].normSquared));
+template <>
+Application::MatBBWorkspace<float>& Application::GetMatBBWorkspace<float>()
+{
+    return ResizeMatBBWorkspace(_matBBWorkspaceFloat, _basisFlowParams->_nbElements);
+}
+
+template <>
+Application::MatBBWorkspace<double>& Application::GetMatBBWorkspace<double>()
+{
+    return ResizeMatBBWorkspace(_matBBWorkspaceDouble, _basisFlowParams->_nbElements);
+}
+
+
+template <class Real>
+Real Application::InverseBBMatrixMain(
+    unsigned int iRow, Real* vecX, const Real* vecB,
+    BasisFlow* basisDataPointer, const NeighborCoeffs<float>& neighbors)
+{
+    Real tempX = vecB[iRow] - GatherBBRow(iRow, neighbors, vecX);
+    Real normSquared = Real(basisDataPointer[iRow].normSquared);
+
+    Real residual = tempX - normSquared * vecX[iRow];
+    vecX[iRow] = tempX / normSquared;
+    return residual;
 }
 
 
-void Application::InverseBBMatrix(
-    DataBuffer1D<double>* vecX,
-    DataBuffer1D<double>* vecB,
+template <class Real>
+Application::SolverStats Application::InverseBBMatrix(
+    DataBuffer1D<Real>* vecX,
+    DataBuffer1D<Real>* vecB,
     unsigned int basisBitMask)
+{
+    SolverSettings settings;
+    settings.solver = _matBBSolver;
+    settings.preconditioner = _matBBPreconditioner;
+    settings.maxNbIterations = _maxNbItMatBBInversion;
+    settings.tolerance = _matBBInversionTolerance;
+    settings.warmStart = _warmStartMatBBInversion;
+    return InverseBBMatrix(vecX, vecB, basisBitMask, settings);
+}
+
+
+template <class Real>
+Application::SolverStats Application::InverseBBMatrix(
+    DataBuffer1D<Real>* vecX,
+    DataBuffer1D<Real>* vecB,
+    unsigned int basisBitMask,
+    const SolverSettings& settings)
 {
     uint n = vecX->_nbElements;
+    SolverStats stats;
 
     // get references
-    double* vecXPointer = vecX->getCpuDataPointer();
-    double* vecBPointer = vecB->getCpuDataPointer();
+    Real* vecXPointer = vecX->getCpuDataPointer();
+    Real* vecBPointer = vecB->getCpuDataPointer();
+    Real* vecResidualPointer = GetMatBBWorkspace<Real>().residual.data();
     BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
 
-    // zero x
-    for (int i = 0; i < int(n); i++) {
-        vecXPointer[i] = 0.;
+    double normSquaredB = InitBBSystem(vecXPointer, vecBPointer, vecResidualPointer, basisBitMask, settings.warmStart);
+    if (normSquaredB == 0.) { return stats; }
+
+    if (settings.solver == MatBBSolver::ConjugateGradient) {
+        return InverseBBMatrixCG(vecXPointer, vecBPointer, basisBitMask, settings, normSquaredB);
     }
 
-    // Gauss-Seidel iterations
-    for (uint iIt = 0; iIt < _maxNbItMatBBInversion; iIt++) {
-        for (int iBasisGroup = 0; iBasisGroup < _orthogonalBasisGroupIds.size(); iBasisGroup++)
+    // Gauss-Seidel iterations. Bases of an orthogonal group are orthogonal to each other, so the
+    // rows of a group are independent and are swept in parallel (multicolor scheme, Section 5.1).
+    // The residual of each row is measured just before it is updated, which costs nothing more
+    // than the sweep itself. With warm start, the first sweep thus measures the residual of the
+    // previous solution, and stops there if it is already accurate enough.
+    const MaskedBasisSet& basisSet = GetMaskedBasisSet(basisBitMask);
+    int nbThreads = int(_solverThreadPool->NbThreads());
+    for (uint iIt = 0; iIt < settings.maxNbIterations; iIt++) {
+        for (const vector<unsigned int>& ids : basisSet.groupIds) {
+            int nbTasks = glm::clamp(int(ids.size()) / _minRowsPerSolverTask, 1, nbThreads);
+            _solverThreadPool->ParallelFor(0, int(ids.size()), nbTasks, [&](int id) {
+                unsigned int iRow = ids[id];
+                vecResidualPointer[iRow] = InverseBBMatrixMain(
+                    iRow, vecXPointer, vecBPointer, basisFlowParamsPointer, basisSet.bb);
+            });
+        }
+
+        double normSquaredResidual = 0.;
+        for (int i = 0; i < int(n); i++) {
+            normSquaredResidual += double(vecResidualPointer[i]) * double(vecResidualPointer[i]);
+        }
+        stats.nbIterations = iIt + 1;
+        stats.relativeResidual = std::sqrt(normSquaredResidual / normSquaredB);
+        if (stats.relativeResidual <= settings.tolerance) { break; }
+    }
+
+    return stats;
+}
+
+
+void Application::UpdateActiveBasisSets()
+{
+    if (!_activeBasisSetsNeedUpdating) { return; }
+    _activeBasisSetsNeedUpdating = false;
+    for (const unique_ptr<MaskedBasisSet>& basisSet : _maskedBasisSets) {
+        basisSet->upToDate = false;
+    }
+    for (const unique_ptr<BatchedBasisSet>& basisSet : _batchedBasisSets) {
+        basisSet->upToDate = false;
+    }
+
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    _simulatedBasisIds.clear();
+    _simulatedBasisFlags.assign(_basisFlowParams->_nbElements, 0);
+    for (unsigned int i = 0; i < _basisFlowParams->_nbElements; i++) {
+        if (AllBitsSet(basisFlowParamsPointer[i].bitFlags, INTERIOR) ||
+            AllBitsSet(basisFlowParamsPointer[i].bitFlags, DYNAMIC_BOUNDARY_PROJECTION))
         {
-            vector<unsigned int> ids = _orthogonalBasisGroupIds[iBasisGroup];
-#pragma omp parallel for shared(vecXPointer,vecBPointer,ids,basisFlowParamsPointer) firstprivate(basisBitMask,minFreq) default(none)
-            for (int id2 = 0; id2 < ids.size(); id2++) {
-                int iRow = ids[id2];
-                if (AllBitsSet(basisFlowParamsPointer[iRow].bitFlags, basisBitMask)) {
-                    InverseBBMatrixMain(iRow, vecXPointer, vecBPointer, basisFlowParamsPointer, basisBitMask);
+            _simulatedBasisIds.push_back(i);
+            _simulatedBasisFlags[i] = 1;
+        }
+    }
+}
+
+
+const Application::MaskedBasisSet& Application::GetMaskedBasisSet(unsigned int basisBitMask)
+{
+    UpdateActiveBasisSets();
+    MaskedBasisSet* basisSet = nullptr;
+    for (const unique_ptr<MaskedBasisSet>& existingBasisSet : _maskedBasisSets) {
+        if (existingBasisSet->basisBitMask == basisBitMask) {
+            basisSet = existingBasisSet.get();
+        }
+    }
+    if (basisSet && basisSet->upToDate) { return *basisSet; }
+
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    vector<unsigned char> selected(nbBasisFlows);
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        selected[i] = AllBitsSet(basisFlowParamsPointer[i].bitFlags, basisBitMask) ? 1 : 0;
+    }
+
+    // flags often change without changing the selection of a mask, e.g. only near a moving obstacle
+    if (basisSet && basisSet->selected == selected) {
+        basisSet->upToDate = true;
+        return *basisSet;
+    }
+    if (!basisSet) {
+        _maskedBasisSets.push_back(make_unique<MaskedBasisSet>());
+        basisSet = _maskedBasisSets.back().get();
+        basisSet->basisBitMask = basisBitMask;
+    }
+    basisSet->selected = std::move(selected);
+    basisSet->upToDate = true;
+    auto isSelected = [&](unsigned int i) { return basisSet->selected[i] != 0; };
+
+    basisSet->groupIds.resize(_orthogonalBasisGroupIds.size());
+    for (size_t iGroup = 0; iGroup < _orthogonalBasisGroupIds.size(); iGroup++) {
+        basisSet->groupIds[iGroup].clear();
+        for (unsigned int i : _orthogonalBasisGroupIds[iGroup]) {
+            if (isSelected(i)) {
+                basisSet->groupIds[iGroup].push_back(i);
+            }
+        }
+    }
+
+    // count the selected neighbors of each selected basis, then copy them
+    const NeighborCoeffs<float>& bb = _coeffsBBDecompressedIntersections;
+    vector<unsigned int> rowSizes(nbBasisFlows, 0);
+    int nbTasks = int(_solverThreadPool->NbThreads());
+    _solverThreadPool->ParallelFor(0, int(bb.NbRows()), nbTasks, [&](int i) {
+        if (!isSelected(i)) { return; }
+        for (unsigned int k = bb.RowBegin(i); k < bb.RowEnd(i); k++) {
+            rowSizes[i] += isSelected(bb.ids[k]) ? 1 : 0;
+        }
+    });
+    basisSet->bb.Resize(rowSizes);
+    _solverThreadPool->ParallelFor(0, int(bb.NbRows()), nbTasks, [&](int i) {
+        if (!isSelected(i)) { return; }
+        unsigned int kMasked = basisSet->bb.RowBegin(i);
+        for (unsigned int k = bb.RowBegin(i); k < bb.RowEnd(i); k++) {
+            if (isSelected(bb.ids[k])) {
+                basisSet->bb.ids[kMasked] = bb.ids[k];
+                basisSet->bb.coeffs[kMasked] = bb.coeffs[k];
+                kMasked++;
+            }
+        }
+    });
+
+    return *basisSet;
+}
+
+
+const Application::BatchedBasisSet& Application::GetBatchedBasisSet(
+    const unsigned int* basisBitMasks, unsigned int nbSystems)
+{
+    vector<unsigned int> masks(basisBitMasks, basisBitMasks + nbSystems);
+    vector<const MaskedBasisSet*> systemSets(nbSystems);
+    for (unsigned int s = 0; s < nbSystems; s++) {
+        systemSets[s] = &GetMaskedBasisSet(masks[s]);
+    }
+    BatchedBasisSet* basisSet = nullptr;
+    for (const unique_ptr<BatchedBasisSet>& existingBasisSet : _batchedBasisSets) {
+        if (existingBasisSet->basisBitMasks == masks) {
+            basisSet = existingBasisSet.get();
+        }
+    }
+    if (basisSet && basisSet->upToDate) { return *basisSet; }
+
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    vector<unsigned char> rowSystems(nbBasisFlows, 0);
+    for (unsigned int s = 0; s < nbSystems; s++) {
+        for (unsigned int i = 0; i < nbBasisFlows; i++) {
+            rowSystems[i] |= systemSets[s]->selected[i] << s;
+        }
+    }
+
+    if (basisSet && basisSet->rowSystems == rowSystems) {
+        basisSet->upToDate = true;
+        return *basisSet;
+    }
+    if (!basisSet) {
+        _batchedBasisSets.push_back(make_unique<BatchedBasisSet>());
+        basisSet = _batchedBasisSets.back().get();
+        basisSet->basisBitMasks = masks;
+        basisSet->systemSets = systemSets;
+    }
+    basisSet->rowSystems = std::move(rowSystems);
+    basisSet->upToDate = true;
+    const vector<unsigned char>& selected = basisSet->rowSystems;
+
+    basisSet->groupIds.resize(_orthogonalBasisGroupIds.size());
+    for (size_t iGroup = 0; iGroup < _orthogonalBasisGroupIds.size(); iGroup++) {
+        basisSet->groupIds[iGroup].clear();
+        for (unsigned int i : _orthogonalBasisGroupIds[iGroup]) {
+            if (selected[i]) {
+                basisSet->groupIds[iGroup].push_back(i);
+            }
+        }
+    }
+
+    // a row is shared if each of its neighbors is used by all of its systems or by none
+    const NeighborCoeffs<float>& bb = _coeffsBBDecompressedIntersections;
+    basisSet->sharedRows.assign(nbBasisFlows, 0);
+    int nbTasks = int(_solverThreadPool->NbThreads());
+    _solverThreadPool->ParallelFor(0, int(bb.NbRows()), nbTasks, [&](int i) {
+        if (!selected[i]) { return; }
+        for (unsigned int k = bb.RowBegin(i); k < bb.RowEnd(i); k++) {
+            unsigned char systems = selected[i] & selected[bb.ids[k]];
+            if (systems != 0 && systems != selected[i]) { return; }
+        }
+        basisSet->sharedRows[i] = 1;
+    });
+
+    return *basisSet;
+}
+
+
+template <class Real>
+double Application::InitBBSystem(
+    Real* vecX, const Real* vecB, Real* vecResidual, unsigned int basisBitMask, bool warmStart)
+{
+    uint n = _basisFlowParams->_nbElements;
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+
+    // zero x, and the residuals of rows that are not updated. With warm start, rows that are
+    // updated start from the previous solution in x instead. Rows that were not updated by the
+    // previous solve are zero in it, so bases that just became selected start from zero.
+    double normSquaredB = 0.;
+    for (int i = 0; i < int(n); i++) {
+        vecResidual[i] = 0;
+        if (AllBitsSet(basisFlowParamsPointer[i].bitFlags, basisBitMask)) {
+            normSquaredB += double(vecB[i]) * double(vecB[i]);
+            if (!warmStart) {
+                vecX[i] = 0;
+            }
+        }
+        else {
+            vecX[i] = 0;
+        }
+    }
+
+    // x = 0 is the solution, as Gauss-Seidel iterations from zero would leave it
+    if (normSquaredB == 0.) {
+        for (int i = 0; i < int(n); i++) {
+            vecX[i] = 0;
+        }
+    }
+
+    return normSquaredB;
+}
+
+
+template <unsigned int NbSystems, class Real>
+void Application::InverseBBMatricesMain(
+    unsigned int iRow, unsigned int systemMask, const BatchedBasisSet& basisSet,
+    Real* const* vecX, const Real* const* vecB, Real* const* vecResidual, BasisFlow* basisDataPointer)
+{
+    unsigned int rowSystems = basisSet.rowSystems[iRow] & systemMask;
+    if (rowSystems == 0) { return; }
+
+    // a shared row is gathered from for one system after the other while it is in the cache
+    const NeighborCoeffs<float>* sharedRow = nullptr;
+    if (basisSet.sharedRows[iRow]) {
+        unsigned int s = 0;
+        while (!(basisSet.rowSystems[iRow] & (1u << s))) { s++; }
+        sharedRow = &basisSet.systemSets[s]->bb;
+    }
+
+    Real normSquared = Real(basisDataPointer[iRow].normSquared);
+    for (unsigned int s = 0; s < NbSystems; s++) {
+        if (!(rowSystems & (1u << s))) { continue; }
+        Real tempX = vecB[s][iRow] - GatherBBRow(iRow, sharedRow ? *sharedRow : basisSet.systemSets[s]->bb, vecX[s]);
+        vecResidual[s][iRow] = tempX - normSquared * vecX[s][iRow];
+        vecX[s][iRow] = tempX / normSquared;
+    }
+}
+
+
+template <class Real>
+void Application::InverseBBMatrices(MatBBSystem<Real>* systems, unsigned int nbSystems)
+{
+    if (_matBBSolver != MatBBSolver::GaussSeidel) {
+        for (unsigned int iSystem = 0; iSystem < nbSystems; iSystem++) {
+            systems[iSystem].stats = InverseBBMatrix(systems[iSystem].vecX, systems[iSystem].vecB, systems[iSystem].basisBitMask);
+        }
+        return;
+    }
+    if (nbSystems > MAX_NB_BATCHED_BB_SYSTEMS) {
+        InverseBBMatrices(systems, MAX_NB_BATCHED_BB_SYSTEMS);
+        InverseBBMatrices(systems + MAX_NB_BATCHED_BB_SYSTEMS, nbSystems - MAX_NB_BATCHED_BB_SYSTEMS);
+        return;
+    }
+
+    uint n = _basisFlowParams->_nbElements;
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+
+    // bit s of activeSystems is set while system s is still iterating
+    unsigned int activeSystems = 0;
+    Real* vecXPointers[MAX_NB_BATCHED_BB_SYSTEMS];
+    const Real* vecBPointers[MAX_NB_BATCHED_BB_SYSTEMS];
+    Real* vecResidualPointers[MAX_NB_BATCHED_BB_SYSTEMS];
+    unsigned int basisBitMasks[MAX_NB_BATCHED_BB_SYSTEMS];
+    double normSquaredBs[MAX_NB_BATCHED_BB_SYSTEMS];
+    for (unsigned int s = 0; s < nbSystems; s++) {
+        MatBBSystem<Real>& system = systems[s];
+        system.stats = SolverStats();
+        vecXPointers[s] = system.vecX->getCpuDataPointer();
+        vecBPointers[s] = system.vecB->getCpuDataPointer();
+        vecResidualPointers[s] = GetMatBBWorkspace<Real>().residualsBatched.data() + size_t(s) * n;
+        basisBitMasks[s] = system.basisBitMask;
+        normSquaredBs[s] = InitBBSystem(vecXPointers[s], vecBPointers[s], vecResidualPointers[s],
+            system.basisBitMask, _warmStartMatBBInversion);
+        if (normSquaredBs[s] != 0.) {
+            activeSystems |= 1u << s;
+        }
+    }
+    if (activeSystems == 0) { return; }
+    const BatchedBasisSet& basisSet = GetBatchedBasisSet(basisBitMasks, nbSystems);
+
+    // Gauss-Seidel iterations of all systems at once, with the groups swept as in InverseBBMatrix.
+    // Once a single system is left, it goes on with the single-system kernel on its own rows.
+    int nbThreads = int(_solverThreadPool->NbThreads());
+    for (uint iIt = 0; iIt < _maxNbItMatBBInversion && activeSystems != 0; iIt++) {
+        bool singleSystem = (activeSystems & (activeSystems - 1)) == 0;
+        unsigned int lastSystem = 0;
+        while (singleSystem && !(activeSystems & (1u << lastSystem))) {
+            lastSystem++;
+        }
+        const MaskedBasisSet* lastSystemSet = basisSet.systemSets[lastSystem];
+
+        for (size_t iGroup = 0; iGroup < _orthogonalBasisGroupIds.size(); iGroup++) {
+            const vector<unsigned int>& groupIds = singleSystem ? lastSystemSet->groupIds[iGroup] : basisSet.groupIds[iGroup];
+            int nbTasks = glm::clamp(int(groupIds.size()) / _minRowsPerSolverTask, 1, nbThreads);
+            _solverThreadPool->ParallelFor(0, int(groupIds.size()), nbTasks, [&](int id) {
+                unsigned int iRow = groupIds[id];
+                if (singleSystem) {
+                    vecResidualPointers[lastSystem][iRow] = InverseBBMatrixMain(iRow, vecXPointers[lastSystem],
+                        vecBPointers[lastSystem], basisFlowParamsPointer, lastSystemSet->bb);
+                    return;
+                }
+                switch (nbSystems) {
+                case 2: InverseBBMatricesMain<2>(iRow, activeSystems, basisSet, vecXPointers, vecBPointers, vecResidualPointers, basisFlowParamsPointer); break;
+                case 3: InverseBBMatricesMain<3>(iRow, activeSystems, basisSet, vecXPointers, vecBPointers, vecResidualPointers, basisFlowParamsPointer); break;
+                default: InverseBBMatricesMain<4>(iRow, activeSystems, basisSet, vecXPointers, vecBPointers, vecResidualPointers, basisFlowParamsPointer); break;
                 }
+            });
+        }
+
+        // converged systems stop iterating
+        for (unsigned int s = 0; s < nbSystems; s++) {
+            if (!(activeSystems & (1u << s))) { continue; }
+            double normSquaredResidual = 0.;
+            for (int i = 0; i < int(n); i++) {
+                normSquaredResidual += double(vecResidualPointers[s][i]) * double(vecResidualPointers[s][i]);
+            }
+            SolverStats& stats = systems[s].stats;
+            stats.nbIterations = iIt + 1;
+            stats.relativeResidual = std::sqrt(normSquaredResidual / normSquaredBs[s]);
+            if (stats.relativeResidual <= _matBBInversionTolerance) {
+                activeSystems &= ~(1u << s);
             }
         }
     }
 }
 
 
+template <class Real>
+Application::SolverStats Application::InverseBBMatrixCG(
+    Real* vecX, const Real* vecB, unsigned int basisBitMask,
+    const SolverSettings& settings, double normSquaredB)
+{
+    uint n = _basisFlowParams->_nbElements;
+    SolverStats stats;
+
+    MatBBWorkspace<Real>& workspace = GetMatBBWorkspace<Real>();
+    Real* vecR = workspace.residual.data();
+    Real* vecP = workspace.cgDirection.data();
+    Real* vecAP = workspace.cgProduct.data();
+    Real* vecZ = workspace.cgPreconditioned.data();
+    Real* vecXBest = workspace.cgBest.data();
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+
+    auto dot = [n](const Real* a, const Real* b) {
+        double result = 0.;
+        for (uint i = 0; i < n; i++) {
+            result += double(a[i]) * double(b[i]);
+        }
+        return result;
+    };
+
+    // r = b - A.x, restricted to the basis flows used
+    auto computeResidual = [&](bool xIsZero) {
+        if (!xIsZero) {
+            MultiplyBBMatrix(vecX, vecAP, basisBitMask);
+        }
+        for (uint i = 0; i < n; i++) {
+            bool used = AllBitsSet(basisFlowParamsPointer[i].bitFlags, basisBitMask);
+            vecR[i] = !used ? Real(0) : xIsZero ? vecB[i] : vecB[i] - vecAP[i];
+        }
+    };
+
+    computeResidual(!settings.warmStart);
+    stats.relativeResidual = std::sqrt(dot(vecR, vecR) / normSquaredB);
+    if (stats.relativeResidual <= settings.tolerance) { return stats; }
+
+    ApplyBBPreconditioner(vecR, vecZ, basisBitMask, settings.preconditioner);
+    std::copy(vecZ, vecZ + n, vecP);
+    double rz = dot(vecR, vecZ);
+
+    // The residual of CG does not decrease monotonically, and once rounding errors dominate on
+    // near singular systems it slowly grows again. The iterate with the lowest residual is kept.
+    double bestRelativeResidual = stats.relativeResidual;
+    std::copy(vecX, vecX + n, vecXBest);
+
+    for (uint iIt = 0; iIt < settings.maxNbIterations; iIt++) {
+        MultiplyBBMatrix(vecP, vecAP, basisBitMask);
+        double pAp = dot(vecP, vecAP);
+        if (!(pAp > 0.)) { break; }
+        Real alpha = Real(rz / pAp);
+        for (uint i = 0; i < n; i++) {
+            vecX[i] += alpha * vecP[i];
+            vecR[i] -= alpha * vecAP[i];
+        }
+
+        // The updated residual drifts away from b - A.x as rounding errors accumulate, which
+        // matters on the large, ill-conditioned systems of fine anisotropic levels. It is replaced
+        // by the true residual regularly, keeping the search direction.
+        if ((iIt + 1) % _nbItCGResidualReplacement == 0) {
+            computeResidual(false);
+        }
+
+        stats.nbIterations = iIt + 1;
+        stats.relativeResidual = std::sqrt(dot(vecR, vecR) / normSquaredB);
+        if (stats.relativeResidual <= settings.tolerance) { break; }
+        if (stats.relativeResidual < bestRelativeResidual) {
+            bestRelativeResidual = stats.relativeResidual;
+            std::copy(vecX, vecX + n, vecXBest);
+        }
+
+        ApplyBBPreconditioner(vecR, vecZ, basisBitMask, settings.preconditioner);
+        double rzNew = dot(vecR, vecZ);
+        Real beta = Real(rzNew / rz);
+        rz = rzNew;
+        for (uint i = 0; i < n; i++) {
+            vecP[i] = vecZ[i] + beta * vecP[i];
+        }
+    }
+
+    if (stats.relativeResidual > bestRelativeResidual) {
+        std::copy(vecXBest, vecXBest + n, vecX);
+        stats.relativeResidual = bestRelativeResidual;
+    }
+
+    return stats;
+}
+
+
+template <class Real>
+void Application::MultiplyBBMatrix(const Real* vecX, Real* vecY, unsigned int basisBitMask)
+{
+    uint n = _basisFlowParams->_nbElements;
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    const MaskedBasisSet& basisSet = GetMaskedBasisSet(basisBitMask);
+
+    // rows are independent
+    int nbTasks = glm::clamp(int(n) / _minRowsPerSolverTask, 1, int(_solverThreadPool->NbThreads()));
+    _solverThreadPool->ParallelFor(0, int(n), nbTasks, [&](int i) {
+        if (!AllBitsSet(basisFlowParamsPointer[i].bitFlags, basisBitMask)) {
+            vecY[i] = 0;
+            return;
+        }
+        vecY[i] = Real(basisFlowParamsPointer[i].normSquared) * vecX[i] + GatherBBRow(i, basisSet.bb, vecX);
+    });
+}
+
+
+template <class Real>
+void Application::ApplyBBPreconditioner(
+    const Real* vecR, Real* vecZ, unsigned int basisBitMask, MatBBPreconditioner preconditioner)
+{
+    uint n = _basisFlowParams->_nbElements;
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+
+    if (preconditioner == MatBBPreconditioner::Jacobi) {
+        for (uint i = 0; i < n; i++) {
+            vecZ[i] = vecR[i] / Real(basisFlowParamsPointer[i].normSquared);
+        }
+        return;
+    }
+
+    // One symmetric Gauss-Seidel sweep from zero on the blocks of each frequency level: groups in
+    // order, then in reverse order. Groups belong to a single frequency level, and only neighbors of
+    // the same level are used, so the rows of a group are still independent.
+    std::fill(vecZ, vecZ + n, Real(0));
+    const MaskedBasisSet& basisSet = GetMaskedBasisSet(basisBitMask);
+    const unsigned int* ids = basisSet.bb.ids.data();
+    const float* coeffs = basisSet.bb.coeffs.data();
+    int nbThreads = int(_solverThreadPool->NbThreads());
+    int nbGroups = int(basisSet.groupIds.size());
+    for (int iSweep = 0; iSweep < 2 * nbGroups; iSweep++) {
+        const vector<unsigned int>& groupIds =
+            basisSet.groupIds[iSweep < nbGroups ? iSweep : 2 * nbGroups - 1 - iSweep];
+        if (groupIds.empty()) { continue; }
+
+        auto freqLvl = upper_bound(_freqLvlBasisOffsets.begin(), _freqLvlBasisOffsets.end(), groupIds[0]);
+        unsigned int freqLvlBegin = *(freqLvl - 1);
+        unsigned int freqLvlEnd = *freqLvl;
+
+        int nbTasks = glm::clamp(int(groupIds.size()) / _minRowsPerSolverTask, 1, nbThreads);
+        _solverThreadPool->ParallelFor(0, int(groupIds.size()), nbTasks, [&](int id) {
+            unsigned int i = groupIds[id];
+            Real z = vecR[i];
+            unsigned int rowEnd = basisSet.bb.RowEnd(i);
+            for (unsigned int k = basisSet.bb.RowBegin(i); k < rowEnd; k++) {
+                unsigned int j = ids[k];
+                if (j >= freqLvlBegin && j < freqLvlEnd) {
+                    z -= Real(coeffs[k]) * vecZ[j];
+                }
+            }
+            vecZ[i] = z / Real(basisFlowParamsPointer[i].normSquared);
+        });
+    }
+}
+
+
+// solves of the simulation (MatBBReal) and of the reference solutions in BenchmarkSolverPrecision
+template Application::SolverStats Application::InverseBBMatrix<float>(
+    DataBuffer1D<float>*, DataBuffer1D<float>*, unsigned int);
+template Application::SolverStats Application::InverseBBMatrix<double>(
+    DataBuffer1D<double>*, DataBuffer1D<double>*, unsigned int);
+template Application::SolverStats Application::InverseBBMatrix<float>(
+    DataBuffer1D<float>*, DataBuffer1D<float>*, unsigned int, const SolverSettings&);
+template Application::SolverStats Application::InverseBBMatrix<double>(
+    DataBuffer1D<double>*, DataBuffer1D<double>*, unsigned int, const SolverSettings&);
+template void Application::InverseBBMatrices<float>(MatBBSystem<float>*, unsigned int);
+template void Application::InverseBBMatrices<double>(MatBBSystem<double>*, unsigned int);
+template void Application::MultiplyBBMatrix<float>(const float*, float*, unsigned int);
+template void Application::MultiplyBBMatrix<double>(const double*, double*, unsigned int);
+
 // eigenflows of Equation 6
 dvec2 eigenLaplace(dvec2 p, dvec2 k) {
     return dvec2(
@@ -125,6 +686,15 @@ float Application::IntegrateBasisGrid(BasisFlow& b, VectorField2D* velField)
 
 float Application::IntegrateBasisBasis(BasisFlow b1, BasisFlow b2) {
 
+    if (_coeffsIntegration == CoeffsIntegration::Analytic) {
+        return float(IntegrateBasisBasisAnalytic(b1, b2, _lengthLvl0));
+    }
+    return IntegrateBasisBasisTrapezoid(b1, b2);
+}
+
+
+float Application::IntegrateBasisBasisTrapezoid(BasisFlow b1, BasisFlow b2) {
+
     BasisSupport sup1 = b1.getSupport();
     BasisSupport sup2 = b2.getSupport();
     float supLeft = glm::max(sup1.left, sup2.left);
@@ -138,8 +708,8 @@ float Application::IntegrateBasisBasis(BasisFlow b1, BasisFlow b2) {
 
     // compute integral as discretized sum at grid centers
     float sum = 0;
-    for (int i = 0; i <= int(_integralGridRes); i++) {
-        for (int j = 0; j <= int(_integralGridRes); j++) {
+    for (unsigned int i = 0; i <= _integralGridRes; i++) {
+        for (unsigned int j = 0; j <= _integralGridRes; j++) {
             vec2 p = vec2(
                 supLeft + float(i) / _integralGridRes * (supRight - supLeft),
                 supBottom + float(j) / _integralGridRes * (supTop - supBottom));
@@ -158,6 +728,15 @@ float Application::IntegrateBasisBasis(BasisFlow b1, BasisFlow b2) {
 
 vec2 Application::AverageBasisOnSupport(BasisFlow bVec, BasisFlow bSupport) {
 
+    if (_coeffsIntegration == CoeffsIntegration::Analytic) {
+        return vec2(AverageBasisOnSupportAnalytic(bVec, bSupport, _lengthLvl0));
+    }
+    return AverageBasisOnSupportTrapezoid(bVec, bSupport);
+}
+
+
+vec2 Application::AverageBasisOnSupportTrapezoid(BasisFlow bVec, BasisFlow bSupport) {
+
     // compute intersection of supports
     BasisSupport supportVec = bVec.getSupport();
     BasisSupport supportSup = bSupport.getSupport();
@@ -196,17 +775,17 @@ void Application::SaveCoeffsBB(string filename)
     if (_newBBCoeffComputed) {
         ofstream file;
         file.open(filename);
-        for (auto coeffPairIt = _coeffsBB.begin(); coeffPairIt != _coeffsBB.end(); coeffPairIt++) {
-            KeyTypeBB key = coeffPairIt->first;
-            float val = coeffPairIt->second;
-            file << get<0>(key) << " " <<
-                get<1>(key) << " " <<
-                get<2>(key) << " " <<
-                get<3>(key) << " " <<
-                get<4>(key) << " " <<
-                get<5>(key) << " " <<
+        _coeffsBB.ForEach([&](KeyTypeBB key, float val) {
+            ivec2 freqLvl1, freqLvl2, snappedOffset;
+            UnpackCoeffKey(key, freqLvl1, freqLvl2, snappedOffset);
+            file << freqLvl1.x << " " <<
+                freqLvl1.y << " " <<
+                freqLvl2.x << " " <<
+                freqLvl2.y << " " <<
+                float(snappedOffset.x) * _coeffSnapSize << " " <<
+                float(snappedOffset.y) * _coeffSnapSize << " " <<
                 val << endl;
-        }
+        });
         file.close();
         std::cout << "saved BB coefficient to " << filename << endl;
     }
@@ -231,16 +810,13 @@ void Application::LoadCoeffsBB(string filename)
             dataF[0] >>
             dataF[1] >>
             dataF[2];
-        KeyTypeBB key = make_tuple(
-            dataUI[0],
-            dataUI[1],
-            dataUI[2],
-            dataUI[3],
-            RoundToMultiple(dataF[0], _coeffSnapSize),
-            RoundToMultiple(dataF[1], _coeffSnapSize)
+        KeyTypeBB key = PackCoeffKey(
+            ivec2(dataUI[0], dataUI[1]),
+            ivec2(dataUI[2], dataUI[3]),
+            ivec2(int(round(dataF[0] / _coeffSnapSize)), int(round(dataF[1] / _coeffSnapSize)))
         );
         float coeff = dataF[2];
-        _coeffsBB.insert(std::pair<KeyTypeBB, float>(key, coeff));
+        _coeffsBB.Insert(key, coeff);
     }
     file.close();
 }
@@ -251,18 +827,18 @@ void Application::SaveCoeffsT(string filename)
     if (_newTCoeffComputed) {
         ofstream file;
         file.open(filename);
-        for (auto coeffPairIt = _coeffsT.begin(); coeffPairIt != _coeffsT.end(); coeffPairIt++) {
-            KeyTypeT key = coeffPairIt->first;
-            vec2 val = coeffPairIt->second;
-            file << get<0>(key) << " " <<
-                get<1>(key) << " " <<
-                get<2>(key) << " " <<
-                get<3>(key) << " " <<
-                get<4>(key) << " " <<
-                get<5>(key) << " " <<
+        _coeffsT.ForEach([&](KeyTypeT key, vec2 val) {
+            ivec2 freqLvl1, freqLvl2, snappedOffset;
+            UnpackCoeffKey(key, freqLvl1, freqLvl2, snappedOffset);
+            file << freqLvl1.x << " " <<
+                freqLvl1.y << " " <<
+                freqLvl2.x << " " <<
+                freqLvl2.y << " " <<
+                float(snappedOffset.x) * _coeffSnapSize << " " <<
+                float(snappedOffset.y) * _coeffSnapSize << " " <<
                 val.x << " " <<
                 val.y << endl;
-        }
+        });
         file.close();
         std::cout << "saved T coefficient to " << filename << endl;
     }
@@ -288,21 +864,134 @@ void Application::LoadCoeffsT(string filename)
             dataF[1] >>
             dataF[2] >>
             dataF[3];
-        KeyTypeT key = make_tuple(
-            dataUI[0],
-            dataUI[1],
-            dataUI[2],
-            dataUI[3],
-            RoundToMultiple(dataF[0], _coeffSnapSize),
-            RoundToMultiple(dataF[1], _coeffSnapSize)
+        KeyTypeT key = PackCoeffKey(
+            ivec2(dataUI[0], dataUI[1]),
+            ivec2(dataUI[2], dataUI[3]),
+            ivec2(int(round(dataF[0] / _coeffSnapSize)), int(round(dataF[1] / _coeffSnapSize)))
         );
         vec2 coeff(dataF[2], dataF[3]);
-        _coeffsT.insert(std::pair<KeyTypeT, vec2>(key, coeff));
+        _coeffsT.Insert(key, coeff);
     }
     file.close();
 }
 
 
+string Application::CoeffsFilename(string coeffType, string extension)
+{
+    stringstream ss;
+    ss << "Data/Coeffs" << "-" << _maxFreqLvl << "-" << _maxAnisoLvl << "-" << coeffType << "." << extension;
+    return ss.str();
+}
+
+
+CoeffsFileParams Application::CoeffsParams()
+{
+    CoeffsFileParams params;
+    params.minFreqLvl = _minFreqLvl;
+    params.maxFreqLvl = _maxFreqLvl;
+    params.maxAnisoLvl = _maxAnisoLvl;
+    params.integralGridRes = _coeffsIntegration == CoeffsIntegration::Trapezoid ? _integralGridRes : 0;
+    params.coeffSnapSize = _coeffSnapSize;
+    params.integration = _coeffsIntegration;
+    return params;
+}
+
+
+static ostream& operator<<(ostream& stream, const CoeffsFileParams& params)
+{
+    return stream << "freq levels " << params.minFreqLvl << "-" << params.maxFreqLvl <<
+        ", aniso level " << params.maxAnisoLvl <<
+        ", integral grid " << params.integralGridRes <<
+        ", snap size " << params.coeffSnapSize <<
+        ", " << (params.integration == CoeffsIntegration::Analytic ? "analytic" : "trapezoid");
+}
+
+
+void Application::PrintCoeffsFileMismatch(string filename, CoeffsFileKind kind)
+{
+    CoeffsFileParams fileParams;
+    if (ReadCoeffsFileParams(filename, kind, fileParams) && !(fileParams == CoeffsParams())) {
+        std::cout << "ignoring " << filename << ", computed with " << fileParams <<
+            " instead of " << CoeffsParams() << endl;
+    }
+}
+
+
+bool Application::MapCoeffsFileBB(string filename)
+{
+    if (!_coeffsBBFile.Open(filename, CoeffsFileKind::BB, CoeffsParams())) {
+        PrintCoeffsFileMismatch(filename, CoeffsFileKind::BB);
+        return false;
+    }
+    std::cout << "mapped " << _coeffsBBFile.NbEntries() << " BB coefficients from " << filename << endl;
+    return true;
+}
+
+
+bool Application::MapCoeffsFileT(string filename)
+{
+    if (!_coeffsTFile.Open(filename, CoeffsFileKind::T, CoeffsParams())) {
+        PrintCoeffsFileMismatch(filename, CoeffsFileKind::T);
+        return false;
+    }
+    std::cout << "mapped " << _coeffsTFile.NbEntries() << " T coefficients from " << filename << endl;
+    return true;
+}
+
+
+void Application::SaveCoeffsFileBB(string filename)
+{
+    if (!_newBBCoeffComputed) { return; }
+
+    // merge previously mapped coefficients with new ones
+    vector<CoeffsFileKey> keys(_coeffsBBFile.Keys(), _coeffsBBFile.Keys() + _coeffsBBFile.NbEntries());
+    vector<float> values(_coeffsBBFile.Values(), _coeffsBBFile.Values() + _coeffsBBFile.NbEntries());
+    _coeffsBB.ForEach([&](KeyTypeBB key, float coeff) {
+        keys.push_back(key);
+        values.push_back(coeff);
+    });
+
+    _coeffsBBFile.Close();
+    if (!WriteCoeffsFile(filename, CoeffsFileKind::BB, CoeffsParams(), keys, values, 1)) {
+        std::cout << "could not save BB coefficients to " << filename << endl;
+        return;
+    }
+    std::cout << "saved BB coefficient to " << filename << endl;
+
+    if (MapCoeffsFileBB(filename)) {
+        _coeffsBB.Clear();
+    }
+    _newBBCoeffComputed = false;
+}
+
+
+void Application::SaveCoeffsFileT(string filename)
+{
+    if (!_newTCoeffComputed) { return; }
+
+    // merge previously mapped coefficients with new ones
+    vector<CoeffsFileKey> keys(_coeffsTFile.Keys(), _coeffsTFile.Keys() + _coeffsTFile.NbEntries());
+    vector<float> values(_coeffsTFile.Values(), _coeffsTFile.Values() + 2 * _coeffsTFile.NbEntries());
+    _coeffsT.ForEach([&](KeyTypeT key, vec2 coeff) {
+        keys.push_back(key);
+        values.push_back(coeff.x);
+        values.push_back(coeff.y);
+    });
+
+    _coeffsTFile.Close();
+    if (!WriteCoeffsFile(filename, CoeffsFileKind::T, CoeffsParams(), keys, values, 2)) {
+        std::cout << "could not save T coefficients to " << filename << endl;
+        return;
+    }
+    std::cout << "saved T coefficient to " << filename << endl;
+
+    if (MapCoeffsFileT(filename)) {
+        _coeffsT.Clear();
+    }
+    _newTCoeffComputed = false;
+}
+
+
 vec2 Application::MatTCoeff(int iTransported, int iTransporting) {
     BasisFlow bTransported = _basisFlowParams->getCpuData(iTransported);
     BasisFlow bTransporting = _basisFlowParams->getCpuData(iTransporting);
@@ -310,10 +999,19 @@ vec2 Application::MatTCoeff(int iTransported, int iTransporting) {
 }
 
 
-vec2 Application::MatTCoeff(BasisFlow bTransported, BasisFlow bTransporting)
+// Swaps x and y
+static ivec2 Transposed(ivec2 v)
+{
+    return ivec2(v.y, v.x);
+}
+
+
+bool Application::CoeffKeyT(const BasisFlow& bTransported, const BasisFlow& bTransporting,
+    KeyTypeT& key, BasisFlow& bRelativeTransported, BasisFlow& bRelativeTransporting, float& baseFreq,
+    CoeffTSymmetry& symmetry)
 {
     if (IntersectionInteriorEmpty(bTransported.getSupport(), bTransporting.getSupport())) {
-        return vec2(0);
+        return false;
     }
 
     int baseLvl;
@@ -321,7 +1019,7 @@ vec2 Application::MatTCoeff(BasisFlow bTransported, BasisFlow bTransporting)
         glm::min<int>(bTransported.freqLvl.x, bTransported.freqLvl.y),
         glm::min<int>(bTransporting.freqLvl.x, bTransporting.freqLvl.y)
         );
-    float baseFreq = powf(2.f, float(baseLvl));
+    baseFreq = powf(2.f, float(baseLvl));
 
     // remove common frequency factors
     ivec2 normFreqLvlTransported = bTransported.freqLvl - baseLvl;
@@ -333,41 +1031,81 @@ vec2 Application::MatTCoeff(BasisFlow bTransported, BasisFlow bTransporting)
     );
 
     // snap offset to fine grid to avoid float errors in dictionary lookups
-    vec2 snappedRelativeOffset(RoundToMultiple(relativeOffset.x, _coeffSnapSize),
-        RoundToMultiple(relativeOffset.y, _coeffSnapSize)
+    ivec2 snappedRelativeOffset(int(round(relativeOffset.x / _coeffSnapSize)),
+        int(round(relativeOffset.y / _coeffSnapSize))
     );
 
+    // Mirroring the offset along x or y flips the sign of the coefficient component orthogonal to
+    // the mirror, so store coefficients of positive offsets only. Transposing both bases and the
+    // offset transposes and negates the coefficient, so store the smallest key of the two.
+    ivec2 absOffset = glm::abs(snappedRelativeOffset);
+    KeyTypeT keyDirect = PackCoeffKey(normFreqLvlTransported, normFreqLvlTransporting, absOffset);
+    KeyTypeT keyTransposed = PackCoeffKey(Transposed(normFreqLvlTransported), Transposed(normFreqLvlTransporting),
+        Transposed(absOffset));
+    symmetry.transposed = keyTransposed < keyDirect;
+    symmetry.offsetSigns = vec2(glm::sign(snappedRelativeOffset));
+    key = symmetry.transposed ? keyTransposed : keyDirect;
+
+    // bases of the canonical pair. Basis offsets are multiples of the snap size.
+    ivec2 canonicalFreqLvlTransported, canonicalFreqLvlTransporting, canonicalOffset;
+    UnpackCoeffKey(key, canonicalFreqLvlTransported, canonicalFreqLvlTransporting, canonicalOffset);
+    bRelativeTransporting = BasisFlow(canonicalFreqLvlTransporting, vec2(0));
+    bRelativeTransported = BasisFlow(canonicalFreqLvlTransported, vec2(canonicalOffset) * _coeffSnapSize);
+
+    return true;
+}
+
+
+bool Application::FindCoeffT(const KeyTypeT& key, vec2& coeff)
+{
+    const vec2* mapCoeff = _coeffsT.Find(key);
+    if (mapCoeff != nullptr) {
+        coeff = *mapCoeff;
+        return true;
+    }
+
+    const float* fileCoeff = _coeffsTFile.Find(key);
+    if (fileCoeff != nullptr) {
+        coeff = vec2(fileCoeff[0], fileCoeff[1]);
+        return true;
+    }
+
+    return false;
+}
+
+
+vec2 Application::MatTCoeff(BasisFlow bTransported, BasisFlow bTransporting)
+{
+    KeyTypeT key;
+    BasisFlow bRelativeTransported, bRelativeTransporting;
+    float baseFreq;
+    CoeffTSymmetry symmetry;
+    if (!CoeffKeyT(bTransported, bTransporting, key, bRelativeTransported, bRelativeTransporting, baseFreq,
+        symmetry)) {
+        return vec2(0);
+    }
+
     // return coefficient if already computed, or else compute it and store it.
-    KeyTypeT key = make_tuple(normFreqLvlTransported.x, normFreqLvlTransported.y,
-        normFreqLvlTransporting.x, normFreqLvlTransporting.y,
-        snappedRelativeOffset.x, snappedRelativeOffset.y);
-    auto coeffPair = _coeffsT.find(key);
     vec2 result;
 
-    if (coeffPair != _coeffsT.end()) {
-        result = coeffPair->second;
-    }
-    else {
+    if (!FindCoeffT(key, result)) {
         vec2 coeff;
 
         // compute coefficient with numerical integration
-        BasisFlow bRelativeTransporting(normFreqLvlTransporting, vec2(0));
-        BasisFlow bRelativeTransported(normFreqLvlTransported, relativeOffset);
-
         coeff = AverageBasisOnSupport(bRelativeTransporting, bRelativeTransported);
 
-        _coeffsT.insert(std::pair<KeyTypeT, vec2>(key, coeff));
+        _coeffsT.Insert(key, coeff);
         result = coeff;
 
-        if (_coeffsT.size() % 1000 == 0) {
-            std::cout << "coeffs T : " << _coeffsT.size() << endl;
+        if (_coeffsT.Size() % 1000 == 0) {
+            std::cout << "coeffs T : " << _coeffsT.Size() << endl;
         }
 
         _newTCoeffComputed = true;
     }
 
-    // scaled coefficient, see Table 2 (exponent is 1)
-    return result * baseFreq;
+    // scaled coefficient of the queried pair, see Table 2 (exponent is 1)
+    return symmetry.Apply(result) * baseFreq;
 
 }
 
@@ -379,10 +1117,10 @@ float Application::MatBBCoeff(int i, int j) {
 }
 
 
-// compute the integral and store it for future use
-float Application::MatBBCoeff(const BasisFlow& b1, const BasisFlow& b2)
+bool Application::CoeffKeyBB(const BasisFlow& b1, const BasisFlow& b2,
+    KeyTypeBB& key, BasisFlow& bRelative1, BasisFlow& bRelative2)
 {
-    if (IntersectionInteriorEmpty(b1.getSupport(), b2.getSupport())) { return 0.0; }
+    if (IntersectionInteriorEmpty(b1.getSupport(), b2.getSupport())) { return false; }
 
     int baseLvl;
     baseLvl = glm::min<int>(
@@ -396,40 +1134,75 @@ float Application::MatBBCoeff(const BasisFlow& b1, const BasisFlow& b2)
     ivec2 normFreqLvl1 = b1.freqLvl - baseLvl;
     ivec2 normFreqLvl2 = b2.freqLvl - baseLvl;
 
-    // all bases are symmetric w.r.t. x and y, so we take the relative offset in the first quadrant.
     vec2 relativeOffset = baseFreq * vec2(
         b2.center.x - b1.center.x,
         b2.center.y - b1.center.y
     );
 
     // snap offset to very fine grid to avoid float errors
-    vec2 snappedRelativeOffset = vec2(RoundToMultiple(relativeOffset.x, _coeffSnapSize),
-        RoundToMultiple(relativeOffset.y, _coeffSnapSize)
+    ivec2 snappedRelativeOffset = ivec2(int(round(relativeOffset.x / _coeffSnapSize)),
+        int(round(relativeOffset.y / _coeffSnapSize))
     );
 
+    // The coefficient is unchanged by mirroring the offset along x or y, so we take the relative
+    // offset in the first quadrant. It is also unchanged by swapping the bases, and by transposing
+    // both bases and the offset, so store the smallest key of the four combinations.
+    ivec2 absOffset = glm::abs(snappedRelativeOffset);
+    key = std::min({
+        PackCoeffKey(normFreqLvl1, normFreqLvl2, absOffset),
+        PackCoeffKey(normFreqLvl2, normFreqLvl1, absOffset),
+        PackCoeffKey(Transposed(normFreqLvl1), Transposed(normFreqLvl2), Transposed(absOffset)),
+        PackCoeffKey(Transposed(normFreqLvl2), Transposed(normFreqLvl1), Transposed(absOffset)) });
+
+    // bases of the canonical pair. Basis offsets are multiples of the snap size.
+    ivec2 canonicalFreqLvl1, canonicalFreqLvl2, canonicalOffset;
+    UnpackCoeffKey(key, canonicalFreqLvl1, canonicalFreqLvl2, canonicalOffset);
+    bRelative1 = BasisFlow(canonicalFreqLvl1, vec2(0));
+    bRelative2 = BasisFlow(canonicalFreqLvl2, vec2(canonicalOffset) * _coeffSnapSize);
+
+    return true;
+}
+
+
+bool Application::FindCoeffBB(const KeyTypeBB& key, float& coeff)
+{
+    const float* mapCoeff = _coeffsBB.Find(key);
+    if (mapCoeff != nullptr) {
+        coeff = *mapCoeff;
+        return true;
+    }
+
+    const float* fileCoeff = _coeffsBBFile.Find(key);
+    if (fileCoeff != nullptr) {
+        coeff = fileCoeff[0];
+        return true;
+    }
+
+    return false;
+}
+
+
+// compute the integral and store it for future use
+float Application::MatBBCoeff(const BasisFlow& b1, const BasisFlow& b2)
+{
+    KeyTypeBB key;
+    BasisFlow bRelative1, bRelative2;
+    if (!CoeffKeyBB(b1, b2, key, bRelative1, bRelative2)) { return 0.0; }
+
     // return coefficient if already computed, or else compute it and store it.
-    KeyTypeBB key = make_tuple(normFreqLvl1.x, normFreqLvl1.y,
-        normFreqLvl2.x, normFreqLvl2.y,
-        snappedRelativeOffset.x, snappedRelativeOffset.y);
-    auto coeffPair = _coeffsBB.find(key);
     float result;
 
-    if (coeffPair != _coeffsBB.end()) {
-        result = coeffPair->second;
-    }
-    else {
+    if (!FindCoeffBB(key, result)) {
         float coeff;
 
         // compute coefficient with numerical integration
-        BasisFlow bRelative1(normFreqLvl1, vec2(0));
-        BasisFlow bRelative2(normFreqLvl2, relativeOffset);
         coeff = float(IntegrateBasisBasis(bRelative1, bRelative2));
 
-        _coeffsBB.insert(std::pair<KeyTypeBB, float>(key, coeff));
+        _coeffsBB.Insert(key, coeff);
         result = coeff;
 
-        if (_coeffsBB.size() % 1000 == 0) {
-            std::cout << "coeffs BB : " << _coeffsBB.size() << endl;
+        if (_coeffsBB.Size() % 1000 == 0) {
+            std::cout << "coeffs BB : " << _coeffsBB.Size() << endl;
         }
 
         _newBBCoeffComputed = true;
@@ -440,15 +1213,241 @@ float Application::MatBBCoeff(const BasisFlow& b1, const BasisFlow& b2)
 }
 
 
-dvec2 flowBasisHat(dvec2 p, int log2Aniso)
+void Application::PrecomputeCoeffsT(const BasisFlow* bases, unsigned int nbActiveBasisFlows)
 {
-    // frequencies are 2^level
-    int kx = 1;
-    int ky = 1 << log2Aniso;
+    // list missing coefficients once per key, in the order a serial traversal would compute them.
+    // Dictionary lookups are done in parallel per row, and rows are then merged in order.
+    vector<vector<unsigned int>> missingNeighbors(nbActiveBasisFlows);
+    ParallelFor(0, int(nbActiveBasisFlows), [&](int i) {
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            if (j >= nbActiveBasisFlows) { continue; }
+            KeyTypeT key;
+            BasisFlow bRelativeTransported, bRelativeTransporting;
+            float baseFreq;
+            vec2 coeff;
+            CoeffTSymmetry symmetry;
+            if (CoeffKeyT(bases[i], bases[j],
+                key, bRelativeTransported, bRelativeTransporting, baseFreq, symmetry) &&
+                !FindCoeffT(key, coeff))
+            {
+                missingNeighbors[i].push_back(j);
+            }
+        }
+    });
+
+    vector<KeyTypeT> missingKeys;
+    vector<pair<BasisFlow, BasisFlow>> missingRelativeBases;
+    unordered_set<KeyTypeT> missingKeysSet;
+    for (unsigned int i = 0; i < nbActiveBasisFlows; i++) {
+        for (unsigned int j : missingNeighbors[i]) {
+            KeyTypeT key;
+            BasisFlow bRelativeTransported, bRelativeTransporting;
+            float baseFreq;
+            CoeffTSymmetry symmetry;
+            CoeffKeyT(bases[i], bases[j],
+                key, bRelativeTransported, bRelativeTransporting, baseFreq, symmetry);
+            if (missingKeysSet.insert(key).second) {
+                missingKeys.push_back(key);
+                missingRelativeBases.push_back(make_pair(bRelativeTransported, bRelativeTransporting));
+            }
+        }
+    }
 
-    double coeffs[3][3];
-    double norm;
+    if (missingKeys.empty()) { return; }
+    std::cout << "computing " << missingKeys.size() << " coefficients T..." << endl;
+
+    // integrate in parallel. AverageBasisOnSupport only reads basis templates.
+    vector<vec2> missingCoeffs(missingKeys.size());
+    atomic<int> nbComputed(0);
+    ParallelFor(0, int(missingKeys.size()), [&](int iKey) {
+        missingCoeffs[iKey] = AverageBasisOnSupport(missingRelativeBases[iKey].second, missingRelativeBases[iKey].first);
+        int nbComputedNow = ++nbComputed;
+        if (nbComputedNow % 1000 == 0) {
+            std::cout << "coeffs T : " << nbComputedNow << " / " << missingKeys.size() << endl;
+        }
+    });
+
+    for (size_t iKey = 0; iKey < missingKeys.size(); iKey++) {
+        _coeffsT.Insert(missingKeys[iKey], missingCoeffs[iKey]);
+    }
+    _newTCoeffComputed = true;
+}
+
+
+void Application::PrecomputeCoeffsBB(const BasisFlow* bases, unsigned int nbActiveBasisFlows)
+{
+    // list missing coefficients once per key, in the order a serial traversal would compute them.
+    // Dictionary lookups are done in parallel per row, and rows are then merged in order.
+    vector<vector<unsigned int>> missingNeighbors(nbActiveBasisFlows);
+    ParallelFor(0, int(nbActiveBasisFlows), [&](int i) {
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            if (j >= nbActiveBasisFlows) { continue; }
+            KeyTypeBB key;
+            BasisFlow bRelative1, bRelative2;
+            float coeff;
+            if (CoeffKeyBB(bases[i], bases[j], key, bRelative1, bRelative2) &&
+                !FindCoeffBB(key, coeff))
+            {
+                missingNeighbors[i].push_back(j);
+            }
+        }
+    });
+
+    vector<KeyTypeBB> missingKeys;
+    vector<pair<BasisFlow, BasisFlow>> missingRelativeBases;
+    unordered_set<KeyTypeBB> missingKeysSet;
+    for (unsigned int i = 0; i < nbActiveBasisFlows; i++) {
+        for (unsigned int j : missingNeighbors[i]) {
+            KeyTypeBB key;
+            BasisFlow bRelative1, bRelative2;
+            CoeffKeyBB(bases[i], bases[j], key, bRelative1, bRelative2);
+            if (missingKeysSet.insert(key).second) {
+                missingKeys.push_back(key);
+                missingRelativeBases.push_back(make_pair(bRelative1, bRelative2));
+            }
+        }
+    }
+
+    if (missingKeys.empty()) { return; }
+    std::cout << "computing " << missingKeys.size() << " coefficients BB..." << endl;
+
+    // integrate in parallel. IntegrateBasisBasis only reads basis templates.
+    vector<float> missingCoeffs(missingKeys.size());
+    atomic<int> nbComputed(0);
+    ParallelFor(0, int(missingKeys.size()), [&](int iKey) {
+        missingCoeffs[iKey] = float(IntegrateBasisBasis(missingRelativeBases[iKey].first, missingRelativeBases[iKey].second));
+        int nbComputedNow = ++nbComputed;
+        if (nbComputedNow % 1000 == 0) {
+            std::cout << "coeffs BB : " << nbComputedNow << " / " << missingKeys.size() << endl;
+        }
+    });
+
+    for (size_t iKey = 0; iKey < missingKeys.size(); iKey++) {
+        _coeffsBB.Insert(missingKeys[iKey], missingCoeffs[iKey]);
+    }
+    _newBBCoeffComputed = true;
+}
+
+
+void Application::DecompressCoeffs(const BasisFlow* bases, unsigned int nbActiveBasisFlows, DecompressedCoeffs& coeffs)
+{
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+
+    // count the neighbors of each row first, so that rows can then be filled in parallel at their
+    // final place in the CSR arrays
+    // Bases of an orthogonal group are orthogonal, so their BB coefficients are only integration
+    // round-off. They are left out of the BB lists, which makes the rows of a group independent when
+    // inverting the B^T.B matrix (see InverseBBMatrix).
+    vector<unsigned int> basisGroups(nbBasisFlows);
+    for (unsigned int iGroup = 0; iGroup < _orthogonalBasisGroupIds.size(); iGroup++) {
+        for (unsigned int i : _orthogonalBasisGroupIds[iGroup]) {
+            basisGroups[i] = iGroup;
+        }
+    }
+
+    vector<unsigned int> rowSizesT(nbBasisFlows, 0);
+    vector<unsigned int> rowSizesBB(nbBasisFlows, 0);
+    vector<unsigned int> rowSizesDeformation[_nbExplicitTransferFreqs];
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+        rowSizesDeformation[iRelFreq].assign(nbBasisFlows, 0);
+    }
+    ParallelFor(0, int(nbActiveBasisFlows), [&](int i) {
+        ivec2 freqI = bases[i].freqLvl;
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            if (j >= nbActiveBasisFlows) { continue; }
+            rowSizesT[i]++;
+            if (j == unsigned(i)) { continue; }
+            if (basisGroups[j] != basisGroups[i]) {
+                rowSizesBB[i]++;
+            }
+
+            ivec2 freqJ = bases[j].freqLvl;
+            for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+                if (freqJ - freqI == _explicitTransferFreqs[iRelFreq]) {
+                    rowSizesDeformation[iRelFreq][i]++;
+                }
+            }
+        }
+    });
+
+    coeffs.t.Resize(rowSizesT);
+    coeffs.bb.Resize(rowSizesBB);
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+        coeffs.deformation[iRelFreq].Resize(rowSizesDeformation[iRelFreq]);
+    }
+    coeffs.explicitTransferSum_abs.clear();
+    coeffs.explicitTransferSum_abs.resize(nbBasisFlows);
+
+    // precompute decompressed T coefficients
+    ParallelFor(0, int(nbActiveBasisFlows), [&](int i) {
+        unsigned int kT = coeffs.t.RowBegin(i);
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            if (j >= nbActiveBasisFlows) { continue; }
+            coeffs.t.ids[kT] = j;
+            coeffs.t.coeffs[kT] = MatTCoeff(bases[i], bases[j]);
+            kT++;
+        }
+    });
+
+    // precompute decompressed BB coefficients
+    ParallelFor(0, int(nbActiveBasisFlows), [&](int i) {
+        float explicitTransferTotalWeight_abs[_nbExplicitTransferFreqs] = { 0 };
+        unsigned int kBB = coeffs.bb.RowBegin(i);
+        unsigned int kDeformation[_nbExplicitTransferFreqs];
+        for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+            kDeformation[iRelFreq] = coeffs.deformation[iRelFreq].RowBegin(i);
+        }
+
+        ivec2 freqI = bases[i].freqLvl;
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            if (j == unsigned(i) || j >= nbActiveBasisFlows) { continue; }
+            float coeff = float(MatBBCoeff(bases[i], bases[j]));
+            if (basisGroups[j] != basisGroups[i]) {
+                coeffs.bb.ids[kBB] = j;
+                coeffs.bb.coeffs[kBB] = coeff;
+                kBB++;
+            }
+
+            ivec2 freqJ = bases[j].freqLvl;
+            for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+                if (freqJ - freqI == _explicitTransferFreqs[iRelFreq]) {
+                    explicitTransferTotalWeight_abs[iRelFreq] += abs(coeff);
+                    coeffs.deformation[iRelFreq].ids[kDeformation[iRelFreq]] = j;
+                    coeffs.deformation[iRelFreq].coeffs[kDeformation[iRelFreq]] = coeff;
+                    kDeformation[iRelFreq]++;
+                }
+            }
+        }
+
+        for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+            coeffs.explicitTransferSum_abs[i].coeffs[iRelFreq] = explicitTransferTotalWeight_abs[iRelFreq];
+        }
+    });
+}
 
+
+void Application::SwapDecompressedCoeffs(DecompressedCoeffs& coeffs)
+{
+    swap(_coeffsTDecompressedIntersections, coeffs.t);
+    swap(_coeffsBBDecompressedIntersections, coeffs.bb);
+    swap(_coeffBBExplicitTransferSum_abs, coeffs.explicitTransferSum_abs);
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+        swap(_intersectingBasesIdsDeformation[iRelFreq], coeffs.deformation[iRelFreq]);
+    }
+    _maskedBasisSets.clear();
+    _batchedBasisSets.clear();
+    _activeBasisSetsNeedUpdating = true;
+    _incomingDeformationEntriesNeedUpdating = true;
+}
+
+
+bool flowBasisHatCoeffs(int log2Aniso, double coeffs[3][3], double& norm)
+{
     switch (log2Aniso) {
     case 0:
         coeffs[0][0] = 1.;
@@ -487,9 +1486,23 @@ dvec2 flowBasisHat(dvec2 p, int log2Aniso)
         norm = 0.5618900800300474;
         break;
     default:
+        return false;
+    }
+    return true;
+}
+
+
+dvec2 flowBasisHat(dvec2 p, int log2Aniso)
+{
+    // frequencies are 2^level
+    int kx = 1;
+    int ky = 1 << log2Aniso;
+
+    double coeffs[3][3];
+    double norm;
+    if (!flowBasisHatCoeffs(log2Aniso, coeffs, norm)) {
         std::cout << "Unknown basis parameters." << endl;
         return dvec2(0, 0);
-        break;
     }
 
     dvec2 p2(p.x + 0.5 / kx, p.y + 0.5 / ky);
@@ -3,66 +3,57 @@
 
 #include <glm\glm.hpp>
 
-#include <tuple>
-#include <unordered_map>
+#include "CoeffsHashMap.h"
+
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include <vector>
 
 
-// Dictionary structure for BB coefficients
-// keys are freqLvlX1, freqLvlY1, freqLvlX2, freqLvlY2, centerDiffX, centerDiffY
-typedef std::tuple<int, int, int, int, float, float> KeyTypeBB;
-struct KeyTypeBB_hash
-{
-    std::size_t operator()(const KeyTypeBB& k) const
-    {
-        std::hash<float> hasher_float;
-        std::hash<int> hasher_uint;
-        return hasher_uint (std::get<0>(k)) ^ hasher_uint (std::get<1>(k)) ^
-            hasher_uint (std::get<2>(k)) ^ hasher_uint (std::get<3>(k)) ^
-            hasher_float(std::get<4>(k)) ^ hasher_float(std::get<5>(k));
-    }
-};
-typedef std::unordered_map<KeyTypeBB,float,KeyTypeBB_hash> MapTypeBB;
+// Dictionary keys. Frequency levels relative to the common base level (freqLvlX1, freqLvlY1,
+// freqLvlX2, freqLvlY2) take 6 bits each, followed by the center offset (centerDiffX, centerDiffY) in
+// multiples of the snap size, 20 bits each in two's complement.
+typedef uint64_t KeyTypeBB;
+typedef uint64_t KeyTypeT;
 
-
-// Dictionary structure for T coefficients
-// keys are freqLvlX1, freqLvlY1, freqLvlX2, freqLvlY2, centerDiffX, centerDiffY
-typedef std::tuple<int, int, int, int, float, float> KeyTypeT;
-struct KeyTypeT_hash
+inline uint64_t PackCoeffKey(glm::ivec2 freqLvl1, glm::ivec2 freqLvl2, glm::ivec2 snappedOffset)
 {
-    std::size_t operator()(const KeyTypeT& k) const
-    {
-        std::hash<float> hasher_float;
-        std::hash<int> hasher_uint;
-    return hasher_uint (std::get<0>(k)) ^ hasher_uint (std::get<1>(k)) ^
-            hasher_uint (std::get<2>(k)) ^ hasher_uint (std::get<3>(k)) ^
-            hasher_float(std::get<4>(k)) ^ hasher_float(std::get<5>(k));
-    }
-};
-typedef std::unordered_map<KeyTypeT,glm::vec2,KeyTypeT_hash> MapTypeT;
-
-
-// Struture to store neighboring T coefficients
-struct CoeffTDecompressedIntersectionInfo {
-    int j;
-    glm::vec2 coeff;
-
-    CoeffTDecompressedIntersectionInfo(int j, glm::vec2 coeff) {
-        this->j = j;
-        this->coeff = coeff;
+    return uint64_t(freqLvl1.x & 0x3f) |
+        uint64_t(freqLvl1.y & 0x3f) << 6 |
+        uint64_t(freqLvl2.x & 0x3f) << 12 |
+        uint64_t(freqLvl2.y & 0x3f) << 18 |
+        uint64_t(snappedOffset.x & 0xfffff) << 24 |
+        uint64_t(snappedOffset.y & 0xfffff) << 44;
+}
+
+inline void UnpackCoeffKey(uint64_t key, glm::ivec2& freqLvl1, glm::ivec2& freqLvl2, glm::ivec2& snappedOffset)
+{
+    freqLvl1 = glm::ivec2(int(key & 0x3f), int(key >> 6 & 0x3f));
+    freqLvl2 = glm::ivec2(int(key >> 12 & 0x3f), int(key >> 18 & 0x3f));
+    // sign-extend offsets
+    snappedOffset = glm::ivec2(int(uint32_t(key >> 24 & 0xfffff) << 12) >> 12,
+        int(uint32_t(key >> 44 & 0xfffff) << 12) >> 12);
+}
+
+// Transformation from the canonical pair of bases of a T dictionary key to the queried pair.
+// Coefficients are odd in the offset orthogonal to their component and even in the other offset,
+// and transposing both bases and the offset transposes and negates the coefficient.
+struct CoeffTSymmetry {
+    bool transposed; // the canonical pair is the transposed queried pair
+    glm::vec2 offsetSigns; // signs of the queried offset, 0 for a zero offset
+
+    glm::vec2 Apply(glm::vec2 canonicalCoeff) const {
+        glm::vec2 coeff = transposed ? -glm::vec2(canonicalCoeff.y, canonicalCoeff.x) : canonicalCoeff;
+        return glm::vec2(offsetSigns.y * coeff.x, offsetSigns.x * coeff.y);
     }
 };
 
-// Struture to store neighboring BB coefficients
-struct CoeffBBDecompressedIntersectionInfo {
-    int j;
-    float coeff;
+// Dictionary structure for BB coefficients
+typedef CoeffsHashMap<float> MapTypeBB;
 
-    CoeffBBDecompressedIntersectionInfo(int j, float coeff) {
-        this->j = j;
-        this->coeff = coeff;
-    }
-};
+// Dictionary structure for T coefficients
+typedef CoeffsHashMap<glm::vec2> MapTypeT;
 
 
 // Rectangular basis flow support (outside of which the basis is zero)
@@ -109,9 +100,6 @@ struct BasisFlow {
     glm::vec2 center; // basis flow center. Corresponds to c_x and c_y in Section 4.1 .
     unsigned int bitFlags; // bitfield of BASIS_FLAGS
     unsigned int stretchBitFlags; // bitfield of BASIS_FLAGS for the stretched basis
-    float coeff; // Basis flow coefficient, corresponds to \tilde{u} in Section 3
-    float newCoeff; //  used when computing new coefficient
-    float coeffBoundary; // basis coefficient or projected dynamic obstacle motion
     glm::vec2 stretchedCornerLB; // left-bottom stretched support corner
     glm::vec2 stretchedCornerLT; // left-top stretched support corner
     glm::vec2 stretchedCornerRB; // right-bottom stretched support corner
@@ -120,9 +108,6 @@ struct BasisFlow {
     bool stretched; // true if the basis is near an obstacle and must be evaluated with a stretch
 
     BasisFlow(glm::ivec2 freq, glm::vec2 center) {
-        coeff = 0;
-        newCoeff = 0;
-        coeffBoundary = 0;
         bitFlags = 0;
         this->freqLvl = freq;
         this->center = center;
@@ -131,9 +116,6 @@ struct BasisFlow {
     }
 
     BasisFlow() {
-        coeff = 0;
-        newCoeff = 0;
-        coeffBoundary = 0;
         bitFlags = 0;
         this->freqLvl = glm::vec2(0);
         this->center = glm::vec2(0);
@@ -148,8 +130,66 @@ struct BasisFlow {
 };
 
 
+// Coefficients of the basis flows, indexed like the basis flows, with one contiguous array per
+// coefficient. They change at every simulation step, while BasisFlow only holds the geometry of the
+// basis flows, so passes over the coefficients do not bring the geometry into the cache.
+struct BasisCoeffs {
+    std::vector<float> coeff; // Basis flow coefficient, corresponds to \tilde{u} in Section 3
+    std::vector<float> coeffBoundary; // basis coefficient or projected dynamic obstacle motion
+
+    size_t Size() const { return coeff.size(); }
+
+    // Resizes all arrays, setting all coefficients to zero
+    void Reset(size_t nbBasisFlows) {
+        coeff.assign(nbBasisFlows, 0.f);
+        coeffBoundary.assign(nbBasisFlows, 0.f);
+    }
+
+    // Velocity weight of a basis flow: its coefficient plus its projected obstacle motion
+    float VelocityWeight(unsigned int i, float boundaryFactor) const {
+        return coeff[i] + boundaryFactor * coeffBoundary[i];
+    }
+
+    // True if both coefficients of a basis flow are below threshold in magnitude
+    bool Quiescent(unsigned int i, float threshold) const {
+        return std::abs(coeff[i]) < threshold && std::abs(coeffBoundary[i]) < threshold;
+    }
+};
+
+
+// Regular lattice of the possible basis flow centers of one frequency level. Bases of a frequency
+// level are centered at origin + index * spacing for integer lattice indices. Used to find bases of
+// a given frequency near a point without looking at other bases.
+struct BasisLattice {
+    glm::ivec2 freqLvl;
+    glm::vec2 origin; // center at lattice index (0,0)
+    glm::vec2 spacing; // distance between neighboring lattice centers
+    glm::ivec2 minIndex; // smallest stored lattice index
+    glm::ivec2 size; // number of stored lattice indices in each direction
+    std::vector<int> ids; // basis id at each stored lattice index, or -1 if there is no basis there
+
+    // Returns the basis id at a lattice index, or -1 if there is no basis there.
+    int BasisId(glm::ivec2 index) const {
+        glm::ivec2 localIndex = index - minIndex;
+        if (localIndex.x < 0 || localIndex.y < 0 || localIndex.x >= size.x || localIndex.y >= size.y) {
+            return -1;
+        }
+        return ids[localIndex.y * size.x + localIndex.x];
+    }
+
+    void SetBasisId(glm::ivec2 index, int id) {
+        glm::ivec2 localIndex = index - minIndex;
+        ids[localIndex.y * size.x + localIndex.x] = id;
+    }
+};
+
+
 // Basis template of Equation 14.
 glm::dvec2 flowBasisHat(glm::dvec2 p, int log2Aniso);
 
+// Coefficients of the eigenflows (2i+1, 2j+1) in the basis template flowBasisHat, and their
+// normalization factor. Returns false if there is no basis template for log2Aniso.
+bool flowBasisHatCoeffs(int log2Aniso, double coeffs[3][3], double& norm);
+
 
 #endif // BASISFLOWS_H
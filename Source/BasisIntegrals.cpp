@@ -0,0 +1,201 @@
+#include "BasisIntegrals.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+static const double PI = glm::pi<double>();
+
+
+// One component of a basis flow, as the sum over i and j of
+// amplitude[i][j] * cos(pi * freqX[i] * x + phaseX[i]) * cos(pi * freqY[j] * y + phaseY[j]).
+// Frequencies are kept without the factor pi so that equal frequencies compare equal exactly.
+struct SeparableComponent {
+    double amplitude[3][3];
+    double freqX[3];
+    double phaseX[3];
+    double freqY[3];
+    double phaseY[3];
+};
+
+
+// Swaps the roles of x and y, and multiplies by sign
+static SeparableComponent Transposed(const SeparableComponent& c, double sign)
+{
+    SeparableComponent result;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            result.amplitude[i][j] = sign * c.amplitude[j][i];
+        }
+        result.freqX[i] = c.freqY[i];
+        result.phaseX[i] = c.phaseY[i];
+        result.freqY[i] = c.freqX[i];
+        result.phaseY[i] = c.phaseX[i];
+    }
+    return result;
+}
+
+
+// Writes basis b as two separable components, one per velocity component. Mirrors
+// Application::TranslatedBasisEval and flowBasisHat. Returns false if b has no basis template.
+static bool SeparableBasis(const BasisFlow& b, float lengthLvl0, SeparableComponent components[2])
+{
+    int minLvl = glm::min<int>(b.freqLvl.x, b.freqLvl.y);
+    int log2Aniso = glm::abs(b.freqLvl.x - b.freqLvl.y);
+    bool swapped = b.freqLvl.x > b.freqLvl.y;
+
+    double coeffs[3][3];
+    double norm;
+    if (!flowBasisHatCoeffs(log2Aniso, coeffs, norm)) { return false; }
+
+    double scale = double(1 << minLvl);
+    double templateScale = scale / double(lengthLvl0);
+    double ky = double(1 << log2Aniso);
+
+    // template coordinates (u,v) are (x,y), or (y,x) for bases with more oscillations along x
+    double centerU = swapped ? b.center.y : b.center.x;
+    double centerV = swapped ? b.center.x : b.center.y;
+
+    // template components: u is n*ky*sin(pi*m*U)*cos(pi*n*ky*V) and v is -m*cos(pi*m*U)*sin(pi*n*ky*V),
+    // with U = templateScale*(u-centerU)+0.5 and V = templateScale*(v-centerV)+0.5/ky
+    SeparableComponent templateU, templateV;
+    for (int i = 0; i < 3; i++) {
+        double m = double(2 * i + 1);
+        double n = double(2 * i + 1);
+        templateU.freqX[i] = templateV.freqX[i] = m * templateScale;
+        templateV.phaseX[i] = PI * m * (0.5 - templateScale * centerU);
+        templateU.phaseX[i] = templateV.phaseX[i] - 0.5 * PI;
+        templateU.freqY[i] = templateV.freqY[i] = n * ky * templateScale;
+        templateU.phaseY[i] = PI * n * (0.5 - ky * templateScale * centerV);
+        templateV.phaseY[i] = templateU.phaseY[i] - 0.5 * PI;
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            double m = double(2 * i + 1);
+            double n = double(2 * j + 1);
+            templateU.amplitude[i][j] = scale * norm * coeffs[i][j] * n * ky;
+            templateV.amplitude[i][j] = -scale * norm * coeffs[i][j] * m;
+        }
+    }
+
+    if (swapped) {
+        // the basis is the template with coordinates and components swapped, and negated
+        components[0] = Transposed(templateV, -1.0);
+        components[1] = Transposed(templateU, -1.0);
+    }
+    else {
+        components[0] = templateU;
+        components[1] = templateV;
+    }
+    return true;
+}
+
+
+// \int_a^b cos(pi * freq * x + phase) dx
+static double IntegrateCos(double freq, double phase, double a, double b)
+{
+    if (freq == 0.0) {
+        return (b - a) * cos(phase);
+    }
+    return (sin(PI * freq * b + phase) - sin(PI * freq * a + phase)) / (PI * freq);
+}
+
+
+// \int_a^b cos(pi * freq1 * x + phase1) * cos(pi * freq2 * x + phase2) dx
+static double IntegrateCosCos(double freq1, double phase1, double freq2, double phase2, double a, double b)
+{
+    return 0.5 * (IntegrateCos(freq1 - freq2, phase1 - phase2, a, b) +
+        IntegrateCos(freq1 + freq2, phase1 + phase2, a, b));
+}
+
+
+double IntegrateBasisBasisAnalytic(const BasisFlow& b1, const BasisFlow& b2, float lengthLvl0)
+{
+    BasisSupport sup1 = b1.getSupport();
+    BasisSupport sup2 = b2.getSupport();
+    double supLeft = glm::max(sup1.left, sup2.left);
+    double supRight = glm::min(sup1.right, sup2.right);
+    double supBottom = glm::max(sup1.bottom, sup2.bottom);
+    double supTop = glm::min(sup1.top, sup2.top);
+
+    if (supLeft >= supRight || supBottom >= supTop) {
+        return 0.0;
+    }
+
+    SeparableComponent components1[2], components2[2];
+    if (!SeparableBasis(b1, lengthLvl0, components1) || !SeparableBasis(b2, lengthLvl0, components2)) {
+        return 0.0;
+    }
+
+    double result = 0.0;
+    for (int iComp = 0; iComp < 2; iComp++) {
+        const SeparableComponent& c1 = components1[iComp];
+        const SeparableComponent& c2 = components2[iComp];
+
+        // 1D integrals of all pairs of factors
+        double integralsX[3][3], integralsY[3][3];
+        for (int i1 = 0; i1 < 3; i1++) {
+            for (int i2 = 0; i2 < 3; i2++) {
+                integralsX[i1][i2] = IntegrateCosCos(c1.freqX[i1], c1.phaseX[i1], c2.freqX[i2], c2.phaseX[i2],
+                    supLeft, supRight);
+                integralsY[i1][i2] = IntegrateCosCos(c1.freqY[i1], c1.phaseY[i1], c2.freqY[i2], c2.phaseY[i2],
+                    supBottom, supTop);
+            }
+        }
+
+        for (int i1 = 0; i1 < 3; i1++) {
+            for (int j1 = 0; j1 < 3; j1++) {
+                for (int i2 = 0; i2 < 3; i2++) {
+                    for (int j2 = 0; j2 < 3; j2++) {
+                        result += c1.amplitude[i1][j1] * c2.amplitude[i2][j2] *
+                            integralsX[i1][i2] * integralsY[j1][j2];
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+
+dvec2 AverageBasisOnSupportAnalytic(const BasisFlow& bVec, const BasisFlow& bSupport, float lengthLvl0)
+{
+    BasisSupport supportVec = bVec.getSupport();
+    BasisSupport supportSup = bSupport.getSupport();
+    double supLeft = glm::max(supportVec.left, supportSup.left);
+    double supRight = glm::min(supportVec.right, supportSup.right);
+    double supBottom = glm::max(supportVec.bottom, supportSup.bottom);
+    double supTop = glm::min(supportVec.top, supportSup.top);
+
+    if (supLeft >= supRight || supBottom >= supTop) {
+        return dvec2(0);
+    }
+
+    SeparableComponent components[2];
+    if (!SeparableBasis(bVec, lengthLvl0, components)) {
+        return dvec2(0);
+    }
+
+    dvec2 result(0);
+    for (int iComp = 0; iComp < 2; iComp++) {
+        const SeparableComponent& c = components[iComp];
+        double integralsX[3], integralsY[3];
+        for (int i = 0; i < 3; i++) {
+            integralsX[i] = IntegrateCos(c.freqX[i], c.phaseX[i], supLeft, supRight);
+            integralsY[i] = IntegrateCos(c.freqY[i], c.phaseY[i], supBottom, supTop);
+        }
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                result[iComp] += c.amplitude[i][j] * integralsX[i] * integralsY[j];
+            }
+        }
+    }
+
+    // divide by domain size to get averaged value
+    double domainSize = (1.0 / double(1 << bSupport.freqLvl.x)) * (1.0 / double(1 << bSupport.freqLvl.y));
+    return result / domainSize;
+}
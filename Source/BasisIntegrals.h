@@ -0,0 +1,21 @@
+// Closed-form integrals of basis flows. A basis flow is a finite sum of eigenflows (see
+// flowBasisHat), so each of its components is a sum of products of a sine or cosine of x and a sine
+// or cosine of y. Integrals of products of bases over rectangles then separate into 1D integrals of
+// products of two sinusoids, which have closed forms.
+
+#ifndef BASISINTEGRALS_H
+#define BASISINTEGRALS_H
+
+#include "BasisFlows.h"
+
+#include <glm/glm.hpp>
+
+// Computes \int(b1.b2), like Application::IntegrateBasisBasis, but exactly.
+// lengthLvl0: width of the support of the first frequency level, see Application::_lengthLvl0
+double IntegrateBasisBasisAnalytic(const BasisFlow& b1, const BasisFlow& b2, float lengthLvl0);
+
+// Computes \int_{S}(bVec)/\int_{S}, where S is bSupport's support, like
+// Application::AverageBasisOnSupport, but exactly.
+glm::dvec2 AverageBasisOnSupportAnalytic(const BasisFlow& bVec, const BasisFlow& bSupport, float lengthLvl0);
+
+#endif // BASISINTEGRALS_H
@@ -0,0 +1,292 @@
+#include "Application.h"
+#include "Obstacles.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace glm;
+using namespace std;
+
+// Incremented whenever the snapshot layout, or the way Init_BasisFlows sets up bases, changes.
+static const uint32_t BASIS_SNAPSHOT_VERSION = 3;
+
+struct BasisSnapshotHeader {
+    char magic[4]; // always "BFBS"
+    uint32_t version; // BASIS_SNAPSHOT_VERSION
+    uint64_t hash; // Application::BasisSnapshotHash
+};
+
+
+// FNV-1a
+static void HashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+template <class T>
+static void HashValue(uint64_t& hash, const T& value)
+{
+    HashBytes(hash, &value, sizeof(T));
+}
+
+
+// Vectors are stored as their size followed by their elements, and lists of rows as the number of
+// rows, the offset of each row in the concatenated rows, and the concatenated rows.
+template <class T>
+static void WriteVector(ostream& file, const vector<T>& v)
+{
+    uint64_t size = v.size();
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+template <class T>
+static bool ReadVector(istream& file, vector<T>& v)
+{
+    uint64_t size;
+    if (!file.read(reinterpret_cast<char*>(&size), sizeof(size))) { return false; }
+    v.resize(size_t(size));
+    return bool(file.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(T)));
+}
+
+template <class Row>
+static void WriteRows(ostream& file, size_t nbRows, Row row)
+{
+    vector<uint64_t> offsets(1, 0);
+    for (size_t i = 0; i < nbRows; i++) {
+        offsets.push_back(offsets.back() + row(i).size());
+    }
+    WriteVector(file, offsets);
+    for (size_t i = 0; i < nbRows; i++) {
+        file.write(reinterpret_cast<const char*>(row(i).data()), row(i).size() * sizeof(row(i)[0]));
+    }
+}
+
+template <class T>
+static bool ReadRows(istream& file, size_t nbRows, vector<vector<T>>& rows)
+{
+    vector<uint64_t> offsets;
+    if (!ReadVector(file, offsets) || offsets.size() != nbRows + 1) { return false; }
+    rows.resize(nbRows);
+    for (size_t i = 0; i < nbRows; i++) {
+        rows[i].resize(size_t(offsets[i + 1] - offsets[i]));
+        if (!file.read(reinterpret_cast<char*>(rows[i].data()), rows[i].size() * sizeof(T))) { return false; }
+    }
+    return true;
+}
+
+// Neighbor lists are already stored in CSR format, and are written as their arrays.
+static void WriteNeighbors(ostream& file, const NeighborIds& neighbors)
+{
+    WriteVector(file, neighbors.rowOffsets);
+    WriteVector(file, neighbors.ids);
+}
+
+template <class T>
+static void WriteNeighbors(ostream& file, const NeighborCoeffs<T>& neighbors)
+{
+    WriteNeighbors(file, static_cast<const NeighborIds&>(neighbors));
+    WriteVector(file, neighbors.coeffs);
+}
+
+static bool ReadNeighbors(istream& file, size_t nbRows, NeighborIds& neighbors)
+{
+    return ReadVector(file, neighbors.rowOffsets) && ReadVector(file, neighbors.ids) &&
+        neighbors.rowOffsets.size() == nbRows + 1 && neighbors.rowOffsets.back() == neighbors.ids.size();
+}
+
+template <class T>
+static bool ReadNeighbors(istream& file, size_t nbRows, NeighborCoeffs<T>& neighbors)
+{
+    return ReadNeighbors(file, nbRows, static_cast<NeighborIds&>(neighbors)) &&
+        ReadVector(file, neighbors.coeffs) && neighbors.coeffs.size() == neighbors.ids.size();
+}
+
+
+uint64_t Application::BasisSnapshotHash()
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    HashValue(hash, BASIS_SNAPSHOT_VERSION);
+    HashValue(hash, sizeof(BasisFlow));
+
+    // domain and frequencies
+    HashValue(hash, _domainCenter);
+    HashValue(hash, _domainHalfSize);
+    HashValue(hash, _lengthLvl0);
+    HashValue(hash, _minFreqLvl);
+    HashValue(hash, _maxFreqLvl);
+    HashValue(hash, _minAnisoLvl);
+    HashValue(hash, _maxAnisoLvl);
+    HashValue(hash, _explicitTransferFreqs);
+
+    // coefficients
+    CoeffsFileParams coeffsParams = CoeffsParams();
+    HashValue(hash, coeffsParams.integralGridRes);
+    HashValue(hash, coeffsParams.coeffSnapSize);
+    HashValue(hash, coeffsParams.integration);
+
+    // Static obstacles decide which bases are kept (see ComputeStretch). They are only known through
+    // their level sets, so hash their values on a grid covering the supports of all bases.
+    HashValue(hash, _nbStretchLoops);
+    HashValue(hash, _stretchBandRatio);
+    const int gridRes = 64;
+    vec2 gridMin = _domainCenter - _domainHalfSize - vec2(_lengthLvl0);
+    vec2 gridMax = _domainCenter + _domainHalfSize + vec2(_lengthLvl0);
+    for (Obstacle* obs : _obstacles) {
+        if (obs->dynamic) { continue; }
+        for (int i = 0; i <= gridRes; i++) {
+            for (int j = 0; j <= gridRes; j++) {
+                vec2 p = gridMin + (gridMax - gridMin) * vec2(float(i), float(j)) / float(gridRes);
+                HashValue(hash, obs->phi(p));
+                HashValue(hash, obs->gradPhi(p));
+            }
+        }
+    }
+
+    return hash;
+}
+
+
+string Application::BasisSnapshotFilename()
+{
+    stringstream ss;
+    ss << "Data/Basis-" << hex << setw(16) << setfill('0') << BasisSnapshotHash() << ".bin";
+    return ss.str();
+}
+
+
+void Application::SaveBasisSnapshot(string filename)
+{
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+
+    filesystem::create_directory("Data");
+    string tempFilename = filename + ".tmp";
+    ofstream file(tempFilename, ios::binary | ios::trunc);
+    if (!file) { return; }
+
+    BasisSnapshotHeader header = {};
+    memcpy(header.magic, "BFBS", 4);
+    header.version = BASIS_SNAPSHOT_VERSION;
+    header.hash = BasisSnapshotHash();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    WriteVector(file, vector<BasisFlow>(basisFlowParamsPointer, basisFlowParamsPointer + nbBasisFlows));
+    WriteVector(file, _freqLvls);
+    WriteVector(file, _freqLvlBasisOffsets);
+    for (const BasisLattice& lattice : _basisLattices) {
+        file.write(reinterpret_cast<const char*>(&lattice.freqLvl), sizeof(lattice.freqLvl));
+        file.write(reinterpret_cast<const char*>(&lattice.origin), sizeof(lattice.origin));
+        file.write(reinterpret_cast<const char*>(&lattice.spacing), sizeof(lattice.spacing));
+        file.write(reinterpret_cast<const char*>(&lattice.minIndex), sizeof(lattice.minIndex));
+        file.write(reinterpret_cast<const char*>(&lattice.size), sizeof(lattice.size));
+        WriteVector(file, lattice.ids);
+    }
+    uint64_t nbGroups = _orthogonalBasisGroupIds.size();
+    file.write(reinterpret_cast<const char*>(&nbGroups), sizeof(nbGroups));
+    WriteRows(file, _orthogonalBasisGroupIds.size(), [&](size_t i) -> const vector<unsigned int>& {
+        return _orthogonalBasisGroupIds[i]; });
+
+    WriteNeighbors(file, _intersectingBasesIds);
+    WriteNeighbors(file, _intersectingBasesIdsTransport);
+    WriteNeighbors(file, _coeffsBBDecompressedIntersections);
+    WriteNeighbors(file, _coeffsTDecompressedIntersections);
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+        WriteNeighbors(file, _intersectingBasesIdsDeformation[iRelFreq]);
+    }
+    WriteVector(file, _coeffBBExplicitTransferSum_abs);
+
+    file.close();
+    if (!file) { return; }
+
+    error_code error;
+    filesystem::rename(tempFilename, filename, error);
+    if (!error) {
+        std::cout << "saved basis setup to " << filename << endl;
+    }
+}
+
+
+bool Application::LoadBasisSnapshot(string filename)
+{
+    ifstream file(filename, ios::binary);
+    if (!file) { return false; }
+
+    BasisSnapshotHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, "BFBS", 4) != 0 ||
+        header.version != BASIS_SNAPSHOT_VERSION ||
+        header.hash != BasisSnapshotHash())
+    {
+        return false;
+    }
+
+    // read everything before modifying the application
+    vector<BasisFlow> bases;
+    vector<ivec2> freqLvls;
+    vector<unsigned int> freqLvlBasisOffsets;
+    if (!ReadVector(file, bases) || !ReadVector(file, freqLvls) || !ReadVector(file, freqLvlBasisOffsets)) {
+        return false;
+    }
+    size_t nbBasisFlows = bases.size();
+
+    vector<BasisLattice> lattices(freqLvls.size());
+    for (BasisLattice& lattice : lattices) {
+        file.read(reinterpret_cast<char*>(&lattice.freqLvl), sizeof(lattice.freqLvl));
+        file.read(reinterpret_cast<char*>(&lattice.origin), sizeof(lattice.origin));
+        file.read(reinterpret_cast<char*>(&lattice.spacing), sizeof(lattice.spacing));
+        file.read(reinterpret_cast<char*>(&lattice.minIndex), sizeof(lattice.minIndex));
+        file.read(reinterpret_cast<char*>(&lattice.size), sizeof(lattice.size));
+        if (!ReadVector(file, lattice.ids)) { return false; }
+    }
+
+    uint64_t nbGroups;
+    vector<vector<unsigned int>> orthogonalBasisGroupIds;
+    NeighborIds intersectingBasesIds, intersectingBasesIdsTransport;
+    DecompressedCoeffs coeffs;
+    bool valid = file.read(reinterpret_cast<char*>(&nbGroups), sizeof(nbGroups)) &&
+        ReadRows(file, size_t(nbGroups), orthogonalBasisGroupIds) &&
+        ReadNeighbors(file, nbBasisFlows, intersectingBasesIds) &&
+        ReadNeighbors(file, nbBasisFlows, intersectingBasesIdsTransport) &&
+        ReadNeighbors(file, nbBasisFlows, coeffs.bb) &&
+        ReadNeighbors(file, nbBasisFlows, coeffs.t);
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+        valid = valid && ReadNeighbors(file, nbBasisFlows, coeffs.deformation[iRelFreq]);
+    }
+    valid = valid && ReadVector(file, coeffs.explicitTransferSum_abs) &&
+        coeffs.explicitTransferSum_abs.size() == nbBasisFlows &&
+        freqLvlBasisOffsets.size() == freqLvls.size() + 1 &&
+        freqLvlBasisOffsets.back() == nbBasisFlows;
+    if (!valid) { return false; }
+
+    // basis flows and groups
+    _basisFlowParams->resize(0);
+    for (const BasisFlow& b : bases) {
+        _basisFlowParams->appendCpu(b);
+    }
+    _freqLvls = freqLvls;
+    _freqLvlBasisOffsets = freqLvlBasisOffsets;
+    _basisLattices = move(lattices);
+    _orthogonalBasisGroupIds = move(orthogonalBasisGroupIds);
+    _nbActiveBasisFlows = (unsigned int)nbBasisFlows;
+
+    SetupBasisFlowBuffers();
+
+    _intersectingBasesIds = move(intersectingBasesIds);
+    _intersectingBasesIdsTransport = move(intersectingBasesIdsTransport);
+    _incomingTransportEntriesNeedUpdating = true;
+
+    SwapDecompressedCoeffs(coeffs);
+
+    std::cout << "restored setup of " << nbBasisFlows << " basis flows from " << filename << endl;
+    return true;
+}
@@ -0,0 +1,839 @@
+// Timings of performance-sensitive parts of the simulation. Enabled with Application::_runBenchmarks.
+
+#include "Application.h"
+#include "BasisIntegrals.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// Milliseconds elapsed since start
+static double ElapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+
+// Dictionary key and hash used before keys were packed in 64-bit integers
+typedef tuple<int, int, int, int, float, float> LegacyCoeffKey;
+struct LegacyCoeffKey_hash
+{
+    size_t operator()(const LegacyCoeffKey& k) const
+    {
+        hash<float> hasher_float;
+        hash<int> hasher_uint;
+        return hasher_uint(get<0>(k)) ^ hasher_uint(get<1>(k)) ^
+            hasher_uint(get<2>(k)) ^ hasher_uint(get<3>(k)) ^
+            hasher_float(get<4>(k)) ^ hasher_float(get<5>(k));
+    }
+};
+
+static LegacyCoeffKey ToLegacyCoeffKey(uint64_t key, float snapSize)
+{
+    ivec2 freqLvl1, freqLvl2, snappedOffset;
+    UnpackCoeffKey(key, freqLvl1, freqLvl2, snappedOffset);
+    return make_tuple(freqLvl1.x, freqLvl1.y, freqLvl2.x, freqLvl2.y,
+        float(snappedOffset.x) * snapSize, float(snappedOffset.y) * snapSize);
+}
+
+// Neighbor coefficients stored as one vector per basis, as before neighbor lists were stored in CSR format
+struct LegacyNeighborBB {
+    int j;
+    float coeff;
+};
+struct LegacyNeighborT {
+    int j;
+    vec2 coeff;
+};
+
+// Bytes used by rows, not counting the overhead of their heap allocations
+template <class T>
+static size_t LegacyRowsBytes(const vector<vector<T>>& rows)
+{
+    size_t bytes = rows.capacity() * sizeof(vector<T>);
+    for (const vector<T>& row : rows) {
+        bytes += row.capacity() * sizeof(T);
+    }
+    return bytes;
+}
+
+static float Checksum(float coeff) { return coeff; }
+static float Checksum(vec2 coeff) { return coeff.x + coeff.y; }
+
+// Looks up keys, in order, in a legacy map and in a packed-key map filled with the same entries
+template <class T>
+static void BenchmarkMapLookup(const string& name, const vector<pair<uint64_t, T>>& entries,
+    const vector<uint64_t>& keys, float snapSize)
+{
+    unordered_map<LegacyCoeffKey, T, LegacyCoeffKey_hash> legacyMap;
+    CoeffsHashMap<T> packedMap;
+    for (const pair<uint64_t, T>& entry : entries) {
+        legacyMap.insert(make_pair(ToLegacyCoeffKey(entry.first, snapSize), entry.second));
+        packedMap.Insert(entry.first, entry.second);
+    }
+    vector<LegacyCoeffKey> legacyKeys(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        legacyKeys[i] = ToLegacyCoeffKey(keys[i], snapSize);
+    }
+
+    size_t maxBucketSize = 0;
+    for (size_t iBucket = 0; iBucket < legacyMap.bucket_count(); iBucket++) {
+        maxBucketSize = std::max(maxBucketSize, legacyMap.bucket_size(iBucket));
+    }
+
+    float legacySum = 0.f;
+    auto start = chrono::steady_clock::now();
+    for (const LegacyCoeffKey& key : legacyKeys) {
+        auto it = legacyMap.find(key);
+        if (it != legacyMap.end()) { legacySum += Checksum(it->second); }
+    }
+    double legacyMs = ElapsedMs(start);
+
+    float packedSum = 0.f;
+    start = chrono::steady_clock::now();
+    for (uint64_t key : keys) {
+        const T* coeff = packedMap.Find(key);
+        if (coeff != nullptr) { packedSum += Checksum(*coeff); }
+    }
+    double packedMs = ElapsedMs(start);
+
+    std::cout << "coefficient lookup " << name << ": " << keys.size() << " lookups in " << entries.size() <<
+        " entries, tuple keys " << legacyMs << " ms (largest bucket " << maxBucketSize << "), packed keys " <<
+        packedMs << " ms, speedup " << legacyMs / std::max(packedMs, 1e-6) <<
+        (legacySum == packedSum ? "" : ", RESULTS DIFFER") << endl;
+}
+
+
+void Application::RunBenchmarks()
+{
+    std::cout << "Running benchmarks..." << endl;
+    WaitLazyCoeffs();
+    BenchmarkCoeffsLoading();
+    BenchmarkCoeffsLookup();
+    BenchmarkCoeffsIntegration();
+    BenchmarkNeighborLists();
+    BenchmarkSolverScaling();
+    BenchmarkMatBBSolvers();
+    BenchmarkBatchedMatBBSolve();
+    BenchmarkSimdKernels();
+    BenchmarkSolverPrecision();
+    BenchmarkAdvectionScaling();
+    BenchmarkBasisDynamics();
+    std::cout << "Benchmarks done." << endl;
+}
+
+
+template <class Function>
+void Application::ForEachThreadCount(Function function)
+{
+    vector<unsigned int> nbThreadsList;
+    unsigned int maxNbThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int nbThreads = 1; nbThreads < maxNbThreads; nbThreads *= 2) {
+        nbThreadsList.push_back(nbThreads);
+    }
+    nbThreadsList.push_back(maxNbThreads);
+
+    unique_ptr<ThreadPool> savedThreadPool = std::move(_solverThreadPool);
+    for (unsigned int nbThreads : nbThreadsList) {
+        _solverThreadPool = make_unique<ThreadPool>(nbThreads);
+        function(nbThreads);
+    }
+    _solverThreadPool = std::move(savedThreadPool);
+}
+
+
+vector<unsigned int> Application::ForceBasisBitFlags(unsigned int basisBitMask)
+{
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+
+    vector<unsigned int> savedBitFlags(nbBasisFlows);
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        savedBitFlags[i] = basisFlowParamsPointer[i].bitFlags;
+        basisFlowParamsPointer[i].bitFlags = i < _nbActiveBasisFlows ?
+            SetBits(basisFlowParamsPointer[i].bitFlags, basisBitMask) : 0;
+    }
+    _activeBasisSetsNeedUpdating = true;
+    return savedBitFlags;
+}
+
+
+void Application::RestoreBasisBitFlags(const vector<unsigned int>& savedBitFlags)
+{
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    for (unsigned int i = 0; i < savedBitFlags.size(); i++) {
+        basisFlowParamsPointer[i].bitFlags = savedBitFlags[i];
+    }
+    _activeBasisSetsNeedUpdating = true;
+}
+
+
+void Application::BenchmarkCoeffsLoading()
+{
+    string textFilenames[2] = { CoeffsFilename("BB", "txt"), CoeffsFilename("T", "txt") };
+    string binaryFilenames[2] = { CoeffsFilename("BB", "bin"), CoeffsFilename("T", "bin") };
+
+    for (int iType = 0; iType < 2; iType++) {
+        if (!filesystem::exists(textFilenames[iType]) || !filesystem::exists(binaryFilenames[iType])) {
+            std::cout << "coefficient loading: " << textFilenames[iType] << " or " << binaryFilenames[iType] <<
+                " missing, skipped" << endl;
+            continue;
+        }
+
+        // text path: parse the whole file into a map
+        size_t nbTextEntries;
+        auto start = chrono::steady_clock::now();
+        if (iType == 0) {
+            MapTypeBB savedCoeffs;
+            swap(savedCoeffs, _coeffsBB);
+            LoadCoeffsBB(textFilenames[iType]);
+            nbTextEntries = _coeffsBB.Size();
+            swap(savedCoeffs, _coeffsBB);
+        }
+        else {
+            MapTypeT savedCoeffs;
+            swap(savedCoeffs, _coeffsT);
+            LoadCoeffsT(textFilenames[iType]);
+            nbTextEntries = _coeffsT.Size();
+            swap(savedCoeffs, _coeffsT);
+        }
+        double textMs = ElapsedMs(start);
+
+        // binary path: map the file and look up every key once, so that all pages are touched
+        start = chrono::steady_clock::now();
+        CoeffsFileMapping mapping;
+        mapping.Open(binaryFilenames[iType], iType == 0 ? CoeffsFileKind::BB : CoeffsFileKind::T, CoeffsParams());
+        double mapMs = ElapsedMs(start);
+        size_t nbFound = 0;
+        for (uint64_t i = 0; i < mapping.NbEntries(); i++) {
+            nbFound += mapping.Find(mapping.Keys()[i]) != nullptr ? 1 : 0;
+        }
+        double binaryMs = ElapsedMs(start);
+
+        std::cout << "coefficient loading " << (iType == 0 ? "BB" : "T") << ": text " << textMs << " ms (" <<
+            nbTextEntries << " entries), binary map " << mapMs << " ms, map + lookup all " << binaryMs <<
+            " ms (" << nbFound << " entries)" << endl;
+    }
+}
+
+
+void Application::BenchmarkCoeffsLookup()
+{
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+
+    // full coefficient queries over all intersecting pairs, as done when decompressing coefficients
+    size_t nbPairs = 0;
+    float sumBB = 0.f;
+    vec2 sumT(0.f);
+    auto start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            sumBB += MatBBCoeff(i, j);
+            nbPairs++;
+        }
+    }
+    double matBBMs = ElapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            sumT += MatTCoeff(i, j);
+        }
+    }
+    double matTMs = ElapsedMs(start);
+    std::cout << "coefficient queries: " << nbPairs << " pairs, MatBBCoeff " << matBBMs << " ms, MatTCoeff " <<
+        matTMs << " ms (checksums " << sumBB << " " << sumT.x + sumT.y << ")" << endl;
+
+    // dictionary lookups only, with keys in the same order as the queries above
+    vector<uint64_t> keysBB, keysT;
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            KeyTypeBB keyBB;
+            KeyTypeT keyT;
+            BasisFlow bRelative1, bRelative2;
+            float baseFreq;
+            CoeffTSymmetry symmetry;
+            if (CoeffKeyBB(basisFlowParamsPointer[i], basisFlowParamsPointer[j], keyBB, bRelative1, bRelative2)) {
+                keysBB.push_back(keyBB);
+            }
+            if (CoeffKeyT(basisFlowParamsPointer[i], basisFlowParamsPointer[j], keyT, bRelative1, bRelative2, baseFreq, symmetry)) {
+                keysT.push_back(keyT);
+            }
+        }
+    }
+
+    vector<pair<uint64_t, float>> entriesBB;
+    for (uint64_t iEntry = 0; iEntry < _coeffsBBFile.NbEntries(); iEntry++) {
+        entriesBB.push_back(make_pair(_coeffsBBFile.Keys()[iEntry], _coeffsBBFile.Values()[iEntry]));
+    }
+    _coeffsBB.ForEach([&](KeyTypeBB key, float coeff) { entriesBB.push_back(make_pair(key, coeff)); });
+
+    vector<pair<uint64_t, vec2>> entriesT;
+    for (uint64_t iEntry = 0; iEntry < _coeffsTFile.NbEntries(); iEntry++) {
+        const float* coeff = _coeffsTFile.Values() + 2 * iEntry;
+        entriesT.push_back(make_pair(_coeffsTFile.Keys()[iEntry], vec2(coeff[0], coeff[1])));
+    }
+    _coeffsT.ForEach([&](KeyTypeT key, vec2 coeff) { entriesT.push_back(make_pair(key, coeff)); });
+
+    BenchmarkMapLookup("BB", entriesBB, keysBB, _coeffSnapSize);
+    BenchmarkMapLookup("T", entriesT, keysT, _coeffSnapSize);
+}
+
+
+void Application::BenchmarkCoeffsIntegration()
+{
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+
+    // relative basis pairs of all distinct dictionary entries
+    vector<pair<BasisFlow, BasisFlow>> pairsBB, pairsT;
+    unordered_set<uint64_t> keysBB, keysT;
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            unsigned int j = _intersectingBasesIds.ids[k];
+            KeyTypeBB keyBB;
+            KeyTypeT keyT;
+            BasisFlow bRelative1, bRelative2;
+            float baseFreq;
+            CoeffTSymmetry symmetry;
+            if (CoeffKeyBB(basisFlowParamsPointer[i], basisFlowParamsPointer[j], keyBB, bRelative1, bRelative2) &&
+                keysBB.insert(keyBB).second) {
+                pairsBB.push_back(make_pair(bRelative1, bRelative2));
+            }
+            if (CoeffKeyT(basisFlowParamsPointer[i], basisFlowParamsPointer[j], keyT, bRelative1, bRelative2, baseFreq, symmetry) &&
+                keysT.insert(keyT).second) {
+                pairsT.push_back(make_pair(bRelative1, bRelative2));
+            }
+        }
+    }
+
+    vector<float> trapezoidBB(pairsBB.size()), analyticBB(pairsBB.size());
+    auto start = chrono::steady_clock::now();
+    for (size_t iPair = 0; iPair < pairsBB.size(); iPair++) {
+        trapezoidBB[iPair] = IntegrateBasisBasisTrapezoid(pairsBB[iPair].first, pairsBB[iPair].second);
+    }
+    double trapezoidBBMs = ElapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (size_t iPair = 0; iPair < pairsBB.size(); iPair++) {
+        analyticBB[iPair] = float(IntegrateBasisBasisAnalytic(pairsBB[iPair].first, pairsBB[iPair].second, _lengthLvl0));
+    }
+    double analyticBBMs = ElapsedMs(start);
+
+    vector<vec2> trapezoidT(pairsT.size()), analyticT(pairsT.size());
+    start = chrono::steady_clock::now();
+    for (size_t iPair = 0; iPair < pairsT.size(); iPair++) {
+        trapezoidT[iPair] = AverageBasisOnSupportTrapezoid(pairsT[iPair].second, pairsT[iPair].first);
+    }
+    double trapezoidTMs = ElapsedMs(start);
+    start = chrono::steady_clock::now();
+    for (size_t iPair = 0; iPair < pairsT.size(); iPair++) {
+        analyticT[iPair] = vec2(AverageBasisOnSupportAnalytic(pairsT[iPair].second, pairsT[iPair].first, _lengthLvl0));
+    }
+    double analyticTMs = ElapsedMs(start);
+
+    float maxDiffBB = 0.f, maxBB = 0.f;
+    for (size_t iPair = 0; iPair < pairsBB.size(); iPair++) {
+        maxDiffBB = std::max(maxDiffBB, abs(trapezoidBB[iPair] - analyticBB[iPair]));
+        maxBB = std::max(maxBB, abs(analyticBB[iPair]));
+    }
+    float maxDiffT = 0.f, maxT = 0.f;
+    for (size_t iPair = 0; iPair < pairsT.size(); iPair++) {
+        maxDiffT = std::max(maxDiffT, length(trapezoidT[iPair] - analyticT[iPair]));
+        maxT = std::max(maxT, length(analyticT[iPair]));
+    }
+
+    std::cout << "coefficient integration BB: " << pairsBB.size() << " entries, trapezoid " << trapezoidBBMs <<
+        " ms, analytic " << analyticBBMs << " ms, max difference " << maxDiffBB << " (max value " << maxBB << ")" << endl;
+    std::cout << "coefficient integration T: " << pairsT.size() << " entries, trapezoid " << trapezoidTMs <<
+        " ms, analytic " << analyticTMs << " ms, max difference " << maxDiffT << " (max value " << maxT << ")" << endl;
+}
+
+
+void Application::BenchmarkNeighborLists()
+{
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    const int nbSweeps = 20;
+
+    // legacy rows, filled with push_back as they used to be
+    vector<vector<LegacyNeighborBB>> legacyBB(nbBasisFlows);
+    vector<vector<LegacyNeighborT>> legacyT(nbBasisFlows);
+    vector<vector<unsigned int>> legacyIds(nbBasisFlows);
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        const NeighborCoeffs<float>& bb = _coeffsBBDecompressedIntersections;
+        for (unsigned int k = bb.RowBegin(i); k < bb.RowEnd(i); k++) {
+            legacyBB[i].push_back({ int(bb.ids[k]), bb.coeffs[k] });
+        }
+        const NeighborCoeffs<vec2>& t = _coeffsTDecompressedIntersections;
+        for (unsigned int k = t.RowBegin(i); k < t.RowEnd(i); k++) {
+            legacyT[i].push_back({ int(t.ids[k]), t.coeffs[k] });
+        }
+        for (unsigned int k = _intersectingBasesIds.RowBegin(i); k < _intersectingBasesIds.RowEnd(i); k++) {
+            legacyIds[i].push_back(_intersectingBasesIds.ids[k]);
+        }
+    }
+
+    size_t legacyBytes = LegacyRowsBytes(legacyBB) + LegacyRowsBytes(legacyT) +
+        LegacyRowsBytes(legacyIds) + nbBasisFlows * sizeof(vector<unsigned int>*);
+    size_t csrBytes = _coeffsBBDecompressedIntersections.MemoryBytes() +
+        _coeffsTDecompressedIntersections.MemoryBytes() + _intersectingBasesIds.MemoryBytes();
+
+    // Gauss-Seidel sweeps of the B^T.B matrix (see InverseBBMatrixMain), followed by a pass of
+    // basis displacement (see ComputeBasisAdvection), which are the hot loops over neighbor lists
+    vector<double> vecX(nbBasisFlows, 0.0), vecB(nbBasisFlows);
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        vecB[i] = _basisCoeffs.coeff[i] + 1.0;
+    }
+
+    vec2 legacyDisplacement(0.f);
+    auto start = chrono::steady_clock::now();
+    for (int iSweep = 0; iSweep < nbSweeps; iSweep++) {
+        for (unsigned int i = 0; i < nbBasisFlows; i++) {
+            float tempX = float(vecB[i]);
+            for (const LegacyNeighborBB& inter : legacyBB[i]) {
+                if (AllBitsSet(basisFlowParamsPointer[inter.j].bitFlags, INTERIOR)) {
+                    tempX -= inter.coeff * float(vecX[inter.j]);
+                }
+            }
+            vecX[i] = double(tempX / float(basisFlowParamsPointer[i].normSquared));
+        }
+        for (unsigned int i = 0; i < nbBasisFlows; i++) {
+            for (const LegacyNeighborT& inter : legacyT[i]) {
+                legacyDisplacement += inter.coeff * float(vecX[inter.j]);
+            }
+        }
+    }
+    double legacyMs = ElapsedMs(start);
+    vector<double> legacyX = vecX;
+
+    std::fill(vecX.begin(), vecX.end(), 0.0);
+    const NeighborCoeffs<float>& bb = _coeffsBBDecompressedIntersections;
+    const NeighborCoeffs<vec2>& t = _coeffsTDecompressedIntersections;
+    vec2 csrDisplacement(0.f);
+    start = chrono::steady_clock::now();
+    for (int iSweep = 0; iSweep < nbSweeps; iSweep++) {
+        for (unsigned int i = 0; i < nbBasisFlows; i++) {
+            float tempX = float(vecB[i]);
+            for (unsigned int k = bb.RowBegin(i); k < bb.RowEnd(i); k++) {
+                unsigned int j = bb.ids[k];
+                if (AllBitsSet(basisFlowParamsPointer[j].bitFlags, INTERIOR)) {
+                    tempX -= bb.coeffs[k] * float(vecX[j]);
+                }
+            }
+            vecX[i] = double(tempX / float(basisFlowParamsPointer[i].normSquared));
+        }
+        for (unsigned int i = 0; i < nbBasisFlows; i++) {
+            for (unsigned int k = t.RowBegin(i); k < t.RowEnd(i); k++) {
+                csrDisplacement += t.coeffs[k] * float(vecX[t.ids[k]]);
+            }
+        }
+    }
+    double csrMs = ElapsedMs(start);
+
+    std::cout << "neighbor lists: " << bb.ids.size() << " BB and " << t.ids.size() << " T neighbors, memory " <<
+        legacyBytes / 1024 << " KiB per-basis vectors (plus " << 3 * nbBasisFlows << " allocations), " <<
+        csrBytes / 1024 << " KiB CSR; " << nbSweeps << " sweeps " << legacyMs << " ms per-basis vectors, " <<
+        csrMs << " ms CSR, speedup " << legacyMs / std::max(csrMs, 1e-6) <<
+        (legacyX == vecX && legacyDisplacement == csrDisplacement ? "" : ", RESULTS DIFFER") << endl;
+}
+
+
+void Application::BenchmarkSolverScaling()
+{
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    const int nbRuns = 5;
+
+    // both projections solve for all active bases, as if forces and boundaries covered the domain
+    vector<unsigned int> savedBitFlags = ForceBasisBitFlags(FORCE_PROJECTION | DYNAMIC_BOUNDARY_PROJECTION);
+
+    DataBuffer1D<MatBBReal> vecX(nbBasisFlows), vecB(nbBasisFlows);
+    vecX.createCpuStorage();
+    vecB.createCpuStorage();
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        vecB.getCpuDataPointer()[i] = MatBBReal(sin(double(i)));
+    }
+
+    size_t maxGroupSize = 0;
+    for (const vector<unsigned int>& ids : _orthogonalBasisGroupIds) {
+        maxGroupSize = std::max(maxGroupSize, ids.size());
+    }
+    std::cout << "solver scaling: " << _orthogonalBasisGroupIds.size() << " orthogonal groups of up to " <<
+        maxGroupSize << " bases, " << _maxNbItMatBBInversion << " iterations" << endl;
+
+    const unsigned int masks[2] = { FORCE_PROJECTION, DYNAMIC_BOUNDARY_PROJECTION };
+    vector<MatBBReal> serialX[2];
+    double serialMs[2] = { 0., 0. };
+    ForEachThreadCount([&](unsigned int nbThreads) {
+        double ms[2];
+        bool sameResults = true;
+        for (int iProjection = 0; iProjection < 2; iProjection++) {
+            // each solve starts from zero, also with warm start, so that all runs do the same work
+            auto solve = [&]() {
+                std::fill(vecX.getCpuDataPointer(), vecX.getCpuDataPointer() + nbBasisFlows, MatBBReal(0));
+                InverseBBMatrix(&vecX, &vecB, masks[iProjection]);
+            };
+            solve();
+            auto start = chrono::steady_clock::now();
+            for (int iRun = 0; iRun < nbRuns; iRun++) {
+                solve();
+            }
+            ms[iProjection] = ElapsedMs(start) / nbRuns;
+
+            vector<MatBBReal> x(vecX.getCpuDataPointer(), vecX.getCpuDataPointer() + nbBasisFlows);
+            if (nbThreads == 1) {
+                serialX[iProjection] = x;
+                serialMs[iProjection] = ms[iProjection];
+            }
+            sameResults = sameResults && x == serialX[iProjection];
+        }
+
+        std::cout << "solver scaling " << nbThreads << " threads: force projection " << ms[0] <<
+            " ms (speedup " << serialMs[0] / std::max(ms[0], 1e-6) << "), boundary projection " << ms[1] <<
+            " ms (speedup " << serialMs[1] / std::max(ms[1], 1e-6) << ")" <<
+            (sameResults ? "" : ", RESULTS DIFFER") << endl;
+    });
+
+    RestoreBasisBitFlags(savedBitFlags);
+}
+
+
+void Application::BenchmarkMatBBSolvers()
+{
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    const unsigned int maxNbIterations = 500;
+
+    // all active bases are used, as in a force projection over the whole domain
+    vector<unsigned int> savedBitFlags = ForceBasisBitFlags(FORCE_PROJECTION);
+
+    // projection of a smooth rotating field
+    vec2 domainCenter = 0.5f * vec2(_domainLeft + _domainRight, _domainBottom + _domainTop);
+    _forceField->populateWithFunction([&](float x, float y) {
+        vec2 p = vec2(x, y) - domainCenter;
+        return vec2(-p.y, p.x) * exp(-4.f * dot(p, p));
+    });
+    // in double precision, so that all tolerances can be reached
+    DataBuffer1D<double> vecX(nbBasisFlows), vecB(nbBasisFlows);
+    vecX.createCpuStorage();
+    vecB.createCpuStorage();
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        vecB.getCpuDataPointer()[i] = i < _nbActiveBasisFlows ?
+            IntegrateBasisGrid(basisFlowParamsPointer[i], _forceField.get()) : 0.;
+    }
+
+    const double tolerances[3] = { 1e-2, 1e-3, 1e-4 };
+    const int nbSolvers = 3;
+    const char* solverNames[nbSolvers] = { "Gauss-Seidel", "CG Jacobi", "CG frequency level blocks" };
+    const MatBBSolver solvers[nbSolvers] = { MatBBSolver::GaussSeidel, MatBBSolver::ConjugateGradient,
+        MatBBSolver::ConjugateGradient };
+    const MatBBPreconditioner preconditioners[nbSolvers] = { MatBBPreconditioner::Jacobi,
+        MatBBPreconditioner::Jacobi, MatBBPreconditioner::FreqLvlBlocks };
+    for (double tolerance : tolerances) {
+        for (int iSolver = 0; iSolver < nbSolvers; iSolver++) {
+            SolverSettings settings;
+            settings.solver = solvers[iSolver];
+            settings.preconditioner = preconditioners[iSolver];
+            settings.maxNbIterations = maxNbIterations;
+            settings.tolerance = tolerance;
+            settings.warmStart = false;
+
+            auto start = chrono::steady_clock::now();
+            SolverStats stats = InverseBBMatrix(&vecX, &vecB, FORCE_PROJECTION, settings);
+            double ms = ElapsedMs(start);
+
+            // the residual Gauss-Seidel measures lags one sweep behind, so compare exact residuals
+            vector<double> vecAX(nbBasisFlows);
+            MultiplyBBMatrix(vecX.getCpuDataPointer(), vecAX.data(), FORCE_PROJECTION);
+            double normSquaredR = 0., normSquaredB = 0.;
+            for (unsigned int i = 0; i < _nbActiveBasisFlows; i++) {
+                normSquaredR += Sqr(vecB.getCpuDataPointer()[i] - vecAX[i]);
+                normSquaredB += Sqr(vecB.getCpuDataPointer()[i]);
+            }
+
+            std::cout << "B^T.B solver, tolerance " << tolerance << ", " << solverNames[iSolver] << ": " <<
+                stats.nbIterations << (stats.nbIterations == maxNbIterations ? " (max)" : "") <<
+                " iterations, " << ms << " ms, relative residual " << std::sqrt(normSquaredR / normSquaredB) << endl;
+        }
+    }
+
+    RestoreBasisBitFlags(savedBitFlags);
+}
+
+
+void Application::BenchmarkBatchedMatBBSolve()
+{
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    const int nbRuns = 5;
+
+    // both projections solve for all active bases, as in BenchmarkSolverScaling
+    vector<unsigned int> savedBitFlags = ForceBasisBitFlags(FORCE_PROJECTION | DYNAMIC_BOUNDARY_PROJECTION);
+
+    DataBuffer1D<MatBBReal> vecX[2] = { DataBuffer1D<MatBBReal>(nbBasisFlows), DataBuffer1D<MatBBReal>(nbBasisFlows) };
+    DataBuffer1D<MatBBReal> vecB[2] = { DataBuffer1D<MatBBReal>(nbBasisFlows), DataBuffer1D<MatBBReal>(nbBasisFlows) };
+    for (int iProjection = 0; iProjection < 2; iProjection++) {
+        vecX[iProjection].createCpuStorage();
+        vecB[iProjection].createCpuStorage();
+        for (unsigned int i = 0; i < nbBasisFlows; i++) {
+            vecB[iProjection].getCpuDataPointer()[i] = MatBBReal(sin(double(i + iProjection * nbBasisFlows)));
+        }
+    }
+
+    const unsigned int masks[2] = { FORCE_PROJECTION, DYNAMIC_BOUNDARY_PROJECTION };
+    auto zeroX = [&]() {
+        for (int iProjection = 0; iProjection < 2; iProjection++) {
+            std::fill(vecX[iProjection].getCpuDataPointer(), vecX[iProjection].getCpuDataPointer() + nbBasisFlows, MatBBReal(0));
+        }
+    };
+
+    vector<MatBBReal> separateX[2];
+    auto start = chrono::steady_clock::now();
+    for (int iRun = 0; iRun < nbRuns; iRun++) {
+        zeroX();
+        for (int iProjection = 0; iProjection < 2; iProjection++) {
+            InverseBBMatrix(&vecX[iProjection], &vecB[iProjection], masks[iProjection]);
+        }
+    }
+    double separateMs = ElapsedMs(start) / nbRuns;
+    for (int iProjection = 0; iProjection < 2; iProjection++) {
+        separateX[iProjection].assign(vecX[iProjection].getCpuDataPointer(), vecX[iProjection].getCpuDataPointer() + nbBasisFlows);
+    }
+
+    MatBBSystem<MatBBReal> systems[2];
+    for (int iProjection = 0; iProjection < 2; iProjection++) {
+        systems[iProjection].vecX = &vecX[iProjection];
+        systems[iProjection].vecB = &vecB[iProjection];
+        systems[iProjection].basisBitMask = masks[iProjection];
+    }
+    start = chrono::steady_clock::now();
+    for (int iRun = 0; iRun < nbRuns; iRun++) {
+        zeroX();
+        InverseBBMatrices(systems, 2);
+    }
+    double batchedMs = ElapsedMs(start) / nbRuns;
+
+    bool sameResults = true;
+    for (int iProjection = 0; iProjection < 2; iProjection++) {
+        sameResults = sameResults && std::equal(separateX[iProjection].begin(), separateX[iProjection].end(),
+            vecX[iProjection].getCpuDataPointer());
+    }
+
+    std::cout << "batched solve: force and boundary projections " << separateMs << " ms separately, " <<
+        batchedMs << " ms batched, speedup " << separateMs / std::max(batchedMs, 1e-6) <<
+        (sameResults ? "" : ", RESULTS DIFFER") << endl;
+
+    RestoreBasisBitFlags(savedBitFlags);
+}
+
+
+// Every row of B^T.B and T through the gather kernels of each level the CPU supports, as in
+// InverseBBMatrixMain and ComputeBasisAdvection
+void Application::BenchmarkSimdKernels()
+{
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    const int nbSweeps = 20;
+
+    vector<double> vecXDouble(nbBasisFlows);
+    vector<float> vecX(nbBasisFlows), weights(nbBasisFlows);
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        vecXDouble[i] = sin(double(i)) + _basisCoeffs.coeff[i];
+        vecX[i] = float(vecXDouble[i]);
+        weights[i] = float(cos(double(i)));
+    }
+
+    const NeighborCoeffs<float>& bb = _coeffsBBDecompressedIntersections;
+    const NeighborCoeffs<vec2>& t = _coeffsTDecompressedIntersections;
+    vector<float> rowsBB(nbBasisFlows), scalarRowsBB;
+    vector<double> rowsBBDouble(nbBasisFlows), scalarRowsBBDouble;
+    vector<vec2> rowsT(nbBasisFlows), scalarRowsT;
+
+    std::cout << "simd kernels: " << bb.ids.size() << " BB and " << t.ids.size() << " T neighbors, " <<
+        nbSweeps << " sweeps";
+    double scalarMsBB = 0.0, scalarMsBBDouble = 0.0, scalarMsT = 0.0;
+    bool sameResults = true;
+    for (int level = int(SimdLevel::Scalar); level <= int(_simdKernels.level); level++) {
+        SimdKernels kernels = GetSimdKernels(SimdLevel(level));
+
+        auto start = chrono::steady_clock::now();
+        for (int iSweep = 0; iSweep < nbSweeps; iSweep++) {
+            for (unsigned int i = 0; i < nbBasisFlows; i++) {
+                rowsBB[i] = kernels.gatherDot(bb.coeffs.data() + bb.RowBegin(i), bb.ids.data() + bb.RowBegin(i),
+                    vecX.data(), bb.RowSize(i));
+            }
+        }
+        double msBB = ElapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        for (int iSweep = 0; iSweep < nbSweeps; iSweep++) {
+            for (unsigned int i = 0; i < nbBasisFlows; i++) {
+                rowsBBDouble[i] = kernels.gatherDotDouble(bb.coeffs.data() + bb.RowBegin(i),
+                    bb.ids.data() + bb.RowBegin(i), vecXDouble.data(), bb.RowSize(i));
+            }
+        }
+        double msBBDouble = ElapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        for (int iSweep = 0; iSweep < nbSweeps; iSweep++) {
+            for (unsigned int i = 0; i < nbBasisFlows; i++) {
+                rowsT[i] = kernels.gatherDotVec2(t.coeffs.data() + t.RowBegin(i), t.ids.data() + t.RowBegin(i),
+                    weights.data(), t.RowSize(i));
+            }
+        }
+        double msT = ElapsedMs(start);
+
+        if (kernels.level == SimdLevel::Scalar) {
+            scalarMsBB = msBB;
+            scalarMsBBDouble = msBBDouble;
+            scalarMsT = msT;
+            scalarRowsBB = rowsBB;
+            scalarRowsBBDouble = rowsBBDouble;
+            scalarRowsT = rowsT;
+        }
+        else {
+            sameResults = sameResults && rowsBB == scalarRowsBB && rowsBBDouble == scalarRowsBBDouble &&
+                rowsT == scalarRowsT;
+        }
+
+        std::cout << "; " << SimdLevelName(kernels.level) << " BB " << msBB << " ms (speedup " <<
+            scalarMsBB / std::max(msBB, 1e-6) << "), BB double " << msBBDouble << " ms (speedup " <<
+            scalarMsBBDouble / std::max(msBBDouble, 1e-6) << "), T " << msT << " ms (speedup " <<
+            scalarMsT / std::max(msT, 1e-6) << ")";
+    }
+    std::cout << (sameResults ? "" : ", RESULTS DIFFER") << endl;
+}
+
+
+// Projections of the same right-hand sides in float and in double, with the solver parameters of the
+// simulation. The double solution is the reference for the accuracy of the float one.
+void Application::BenchmarkSolverPrecision()
+{
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    const int nbRuns = 10;
+
+    // both projections solve for all active bases, as in BenchmarkSolverScaling
+    vector<unsigned int> savedBitFlags = ForceBasisBitFlags(FORCE_PROJECTION | DYNAMIC_BOUNDARY_PROJECTION);
+
+    DataBuffer1D<float> vecXFloat(nbBasisFlows), vecBFloat(nbBasisFlows);
+    DataBuffer1D<double> vecXDouble(nbBasisFlows), vecBDouble(nbBasisFlows);
+    vecXFloat.createCpuStorage();
+    vecBFloat.createCpuStorage();
+    vecXDouble.createCpuStorage();
+    vecBDouble.createCpuStorage();
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        vecBFloat.getCpuDataPointer()[i] = float(sin(double(i)));
+        vecBDouble.getCpuDataPointer()[i] = double(vecBFloat.getCpuDataPointer()[i]);
+    }
+
+    // a sweep streams the coefficients and ids of all rows, and gathers from x, b and the residual
+    const NeighborCoeffs<float>& bb = _coeffsBBDecompressedIntersections;
+    size_t matrixBytes = bb.ids.size() * (sizeof(float) + sizeof(unsigned int));
+    size_t nbVectorEntries = 3 * size_t(nbBasisFlows);
+
+    const unsigned int masks[2] = { FORCE_PROJECTION, DYNAMIC_BOUNDARY_PROJECTION };
+    auto timeSolve = [&](auto& vecX, auto& vecB, unsigned int mask) {
+        auto start = chrono::steady_clock::now();
+        for (int iRun = 0; iRun < nbRuns; iRun++) {
+            InverseBBMatrix(&vecX, &vecB, mask);
+        }
+        return ElapsedMs(start) / nbRuns;
+    };
+
+    for (int iProjection = 0; iProjection < 2; iProjection++) {
+        double floatMs = timeSolve(vecXFloat, vecBFloat, masks[iProjection]);
+        double doubleMs = timeSolve(vecXDouble, vecBDouble, masks[iProjection]);
+
+        // difference between the solutions, and residuals of both measured in double
+        vector<double> vecXFromFloat(vecXFloat.getCpuDataPointer(), vecXFloat.getCpuDataPointer() + nbBasisFlows);
+        vector<double> vecAXFloat(nbBasisFlows), vecAXDouble(nbBasisFlows);
+        MultiplyBBMatrix(vecXFromFloat.data(), vecAXFloat.data(), masks[iProjection]);
+        MultiplyBBMatrix(vecXDouble.getCpuDataPointer(), vecAXDouble.data(), masks[iProjection]);
+        double normSquaredDiff = 0., normSquaredX = 0., normSquaredRFloat = 0., normSquaredRDouble = 0., normSquaredB = 0.;
+        for (unsigned int i = 0; i < _nbActiveBasisFlows; i++) {
+            double b = vecBDouble.getCpuDataPointer()[i];
+            normSquaredDiff += Sqr(vecXFromFloat[i] - vecXDouble.getCpuDataPointer()[i]);
+            normSquaredX += Sqr(vecXDouble.getCpuDataPointer()[i]);
+            normSquaredRFloat += Sqr(b - vecAXFloat[i]);
+            normSquaredRDouble += Sqr(b - vecAXDouble[i]);
+            normSquaredB += Sqr(b);
+        }
+
+        std::cout << "solver precision, " << (iProjection == 0 ? "force" : "boundary") << " projection: float " <<
+            floatMs << " ms, double " << doubleMs << " ms, speedup " << doubleMs / std::max(floatMs, 1e-6) <<
+            "; per sweep " << matrixBytes / 1024 << " KiB of matrix, vectors " << nbVectorEntries * sizeof(float) / 1024 <<
+            " KiB in float, " << nbVectorEntries * sizeof(double) / 1024 << " KiB in double; relative residual float " <<
+            std::sqrt(normSquaredRFloat / normSquaredB) << ", double " << std::sqrt(normSquaredRDouble / normSquaredB) <<
+            "; float solution relative error " << std::sqrt(normSquaredDiff / normSquaredX) << endl;
+    }
+
+    RestoreBasisBitFlags(savedBitFlags);
+}
+
+
+void Application::BenchmarkAdvectionScaling()
+{
+    const int nbRuns = 5;
+
+    // every run advects the same coefficients
+    BasisCoeffs savedCoeffs = _basisCoeffs;
+    auto advect = [&]() {
+        _basisCoeffs = savedCoeffs;
+        ComputeBasisAdvection();
+    };
+
+    vector<float> serialCoeffs;
+    double serialMs = 0.;
+    ForEachThreadCount([&](unsigned int nbThreads) {
+        advect();
+        auto start = chrono::steady_clock::now();
+        for (int iRun = 0; iRun < nbRuns; iRun++) {
+            advect();
+        }
+        double ms = ElapsedMs(start) / nbRuns;
+
+        vector<float> coeffs = _basisCoeffs.coeff;
+        if (nbThreads == 1) {
+            serialCoeffs = coeffs;
+            serialMs = ms;
+        }
+
+        std::cout << "advection scaling " << nbThreads << " threads: " << _simulatedBasisIds.size() <<
+            " advected bases " << ms << " ms (speedup " << serialMs / std::max(ms, 1e-6) << ")" <<
+            (coeffs == serialCoeffs ? "" : ", RESULTS DIFFER") << endl;
+    });
+
+    _basisCoeffs = savedCoeffs;
+}
+
+
+void Application::BenchmarkBasisDynamics()
+{
+    const int nbRuns = 10;
+
+    // every run advects the same coefficients, which are restored outside of the timed advection
+    BasisCoeffs savedCoeffs = _basisCoeffs;
+    ComputeBasisAdvection();
+    double ms = 0.;
+    for (int iRun = 0; iRun < nbRuns; iRun++) {
+        _basisCoeffs = savedCoeffs;
+        auto start = chrono::steady_clock::now();
+        ComputeBasisAdvection();
+        ms += ElapsedMs(start);
+    }
+    ms /= nbRuns;
+    _basisCoeffs = savedCoeffs;
+
+    std::cout << "basis dynamics: " << _basisFlowParams->_nbElements << " bases, " << _simulatedBasisIds.size() <<
+        " simulated, " << _awakeBasisIds.size() << " awake (" << 100.f * AwakeBasisFraction() << "%); " <<
+        _basisDynamicsSweeps.all << " sweeps over all bases, " << _basisDynamicsSweeps.simulated <<
+        " over simulated bases and " << _basisDynamicsSweeps.awake << " over awake bases per step, " <<
+        ms << " ms per step" << endl;
+}
@@ -36,8 +36,6 @@ BasisFlow Application::ComputeStretch(BasisFlow b, bool staticObstaclesOnly) {
         // gradient cases inside the obstacle.
         if (obs->phi(b.center) < 0) {
             b.bitFlags = UnsetBits(b.bitFlags, INTERIOR);
-            b.coeff = 0;
-            b.coeffBoundary = 0;
         }
     }
 
@@ -100,8 +98,6 @@ BasisFlow Application::ComputeStretch(BasisFlow b, bool staticObstaclesOnly) {
                 ) {
                 // stretched point too close to center, basis is invalid
                 b.bitFlags = UnsetBits(b.bitFlags, INTERIOR);
-                b.coeff = 0;
-                b.coeffBoundary = 0;
             }
             else if (dist >= 0 && (
                 abs((sp - originalCorner).x) >= shs.x*_stretchBandRatio ||
@@ -253,10 +249,18 @@ BasisFlow Application::ComputeStretch(BasisFlow b, bool staticObstaclesOnly) {
 
 void Application::ComputeStretches()
 {
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
     for (unsigned int iBasis = 0; iBasis < _basisFlowParams->_nbElements; ++iBasis) {
-        BasisFlow b = _basisFlowParams->getCpuData(iBasis);
+        BasisFlow& b = basisFlowParamsPointer[iBasis];
+        b.bitFlags = 0;
         b = ComputeStretch(b, false);
-        _basisFlowParams->setCpuData(iBasis, b);
+        b.stretchBitFlags = b.bitFlags;
+
+        // invalid bases lose their coefficients
+        if (!AllBitsSet(b.bitFlags, INTERIOR)) {
+            _basisCoeffs.coeff[iBasis] = 0;
+            _basisCoeffs.coeffBoundary[iBasis] = 0;
+        }
     }
 }
 
@@ -300,7 +304,7 @@ mat2 Application::QuadCoordInvDeriv(vec2 uv, BasisFlow const& b)
 }
 
 
-vec2 Application::VecObstacle_stretch(vec2 p, BasisFlow const& b)
+vec2 Application::VecObstacle_stretch(vec2 p, BasisFlow const& b, float coeff)
 {
     vec2 vec;
     if (!AllBitsSet(b.bitFlags, INTERIOR) &&
@@ -308,7 +312,7 @@ vec2 Application::VecObstacle_stretch(vec2 p, BasisFlow const& b)
         vec = vec2(1);
     }
     else if (!b.stretched) {
-        vec = b.coeff * TranslatedBasisEval(p, b.freqLvl, b.center);
+        vec = coeff * TranslatedBasisEval(p, b.freqLvl, b.center);
     }
     else {
         vec2 uv = QuadCoord(p, b); // World space to UV space
@@ -317,7 +321,7 @@ vec2 Application::VecObstacle_stretch(vec2 p, BasisFlow const& b)
 
         // multiplication by mat to inverse deformation from World to UV.
         // division to inverse deformation from UV to basis domain
-        vec = b.coeff *
+        vec = coeff *
             mat *
             TranslatedBasisEval(pos, b.freqLvl, b.center) /
             (2.f * b.supportHalfSize());
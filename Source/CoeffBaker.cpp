@@ -0,0 +1,117 @@
+// Headless tool that computes the BB and T coefficient dictionaries, so they can be baked offline
+// and shipped with the application instead of being computed on its first launch. Dictionaries are
+// written to the Data folder of the working directory, where the application looks for them, and
+// record the parameters below in their header. The application ignores dictionaries computed with
+// parameters other than its own.
+//
+// Usage: CoeffBaker [--min-freq-lvl N] [--max-freq-lvl N] [--max-aniso-lvl N]
+//                   [--integral-grid-res N] [--coeff-snap-size X] [--integration analytic|trapezoid]
+//
+// Parameters default to the application's. The dictionaries hold the coefficients of all pairs of
+// intersecting bases of the simulation domain without obstacles, which includes all the pairs the
+// application needs with any obstacles.
+
+#include "Application.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+Application* app = nullptr;
+
+static void PrintUsage()
+{
+    cerr << "Usage: CoeffBaker [--min-freq-lvl N] [--max-freq-lvl N] [--max-aniso-lvl N]" << endl <<
+        "                  [--integral-grid-res N] [--coeff-snap-size X] [--integration analytic|trapezoid]" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    // defaults of the application
+    unique_ptr<Application> defaults = make_unique<Application>();
+    CoeffsFileParams params;
+    params.minFreqLvl = defaults->_minFreqLvl;
+    params.maxFreqLvl = defaults->_maxFreqLvl;
+    params.maxAnisoLvl = defaults->_maxAnisoLvl;
+    params.integralGridRes = defaults->_integralGridRes;
+    params.integration = defaults->_coeffsIntegration;
+    float lengthLvl0 = defaults->_lengthLvl0;
+    defaults.reset();
+
+    bool hasCoeffSnapSize = false;
+    for (int iArg = 1; iArg < argc; iArg++) {
+        string arg = argv[iArg];
+        if (iArg + 1 >= argc) {
+            PrintUsage();
+            return 1;
+        }
+        const char* value = argv[++iArg];
+
+        if (arg == "--min-freq-lvl") {
+            params.minFreqLvl = atoi(value);
+        }
+        else if (arg == "--max-freq-lvl") {
+            params.maxFreqLvl = atoi(value);
+        }
+        else if (arg == "--max-aniso-lvl") {
+            params.maxAnisoLvl = atoi(value);
+        }
+        else if (arg == "--integral-grid-res") {
+            params.integralGridRes = unsigned(atoi(value));
+        }
+        else if (arg == "--coeff-snap-size") {
+            params.coeffSnapSize = float(atof(value));
+            hasCoeffSnapSize = true;
+        }
+        else if (arg == "--integration" && strcmp(value, "analytic") == 0) {
+            params.integration = CoeffsIntegration::Analytic;
+        }
+        else if (arg == "--integration" && strcmp(value, "trapezoid") == 0) {
+            params.integration = CoeffsIntegration::Trapezoid;
+        }
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    // same default as Application::_coeffSnapSize
+    if (!hasCoeffSnapSize) {
+        params.coeffSnapSize = lengthLvl0 / float(1 << params.maxFreqLvl) / 32.0f;
+    }
+
+    // Offsets between bases are less than lengthLvl0 once scaled to their common frequency level,
+    // and are stored in 20 bits in dictionary keys (see PackCoeffKey).
+    if (params.minFreqLvl < 0 || params.maxFreqLvl < params.minFreqLvl || params.maxFreqLvl > 30 ||
+        params.maxAnisoLvl < 0 || params.maxAnisoLvl > 2 ||
+        params.integralGridRes == 0 ||
+        !(params.coeffSnapSize > 0.f) || lengthLvl0 / params.coeffSnapSize >= float(1 << 19))
+    {
+        cerr << "Invalid parameters." << endl;
+        PrintUsage();
+        return 1;
+    }
+
+    cout << "Baking coefficients for frequency levels " << params.minFreqLvl << " to " << params.maxFreqLvl <<
+        ", anisotropy levels up to " << params.maxAnisoLvl << ", snap size " << params.coeffSnapSize;
+    if (params.integration == CoeffsIntegration::Trapezoid) {
+        cout << ", trapezoid integration on " << params.integralGridRes << " cells" << endl;
+    }
+    else {
+        cout << ", analytic integration" << endl;
+    }
+
+    app = new Application(params);
+    if (!app->Init_BasisFlowBuffers() || !app->Init_BasisFlows()) {
+        cerr << "Error baking coefficients." << endl;
+        return 1;
+    }
+    cout << "Coefficients saved to " << app->CoeffsFilename("BB", "bin") << " and " <<
+        app->CoeffsFilename("T", "bin") << endl;
+
+    delete app;
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "CoeffsFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+CoeffsFileMapping::~CoeffsFileMapping()
+{
+    Close();
+}
+
+
+bool CoeffsFileMapping::Open(const string& filename, CoeffsFileKind kind, const CoeffsFileParams& params)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) { return false; }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return false;
+    }
+    _data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (_data == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    _fileHandle = file;
+    _mappingHandle = mapping;
+    _size = uint64_t(fileSize.QuadPart);
+#else
+    int file = open(filename.c_str(), O_RDONLY);
+    if (file < 0) { return false; }
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+        close(file);
+        return false;
+    }
+    void* data = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) { return false; }
+    _data = static_cast<const char*>(data);
+    _size = uint64_t(fileStat.st_size);
+#endif
+
+    // validate header and table sizes
+    _header = reinterpret_cast<const CoeffsFileHeader*>(_data);
+    bool valid = _size >= sizeof(CoeffsFileHeader) &&
+        memcmp(_header->magic, "BFCD", 4) == 0 &&
+        _header->version == COEFFS_FILE_VERSION &&
+        _header->kind == uint32_t(kind) &&
+        _header->params == params &&
+        _size == sizeof(CoeffsFileHeader) +
+        _header->nbEntries * (sizeof(CoeffsFileKey) + _header->nbValueComponents * sizeof(float));
+
+    if (!valid) {
+        Close();
+        return false;
+    }
+
+    _keys = reinterpret_cast<const CoeffsFileKey*>(_data + sizeof(CoeffsFileHeader));
+    _values = reinterpret_cast<const float*>(_keys + _header->nbEntries);
+    return true;
+}
+
+
+void CoeffsFileMapping::Close()
+{
+    if (_data != nullptr) {
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+        CloseHandle(_mappingHandle);
+        CloseHandle(_fileHandle);
+        _mappingHandle = nullptr;
+        _fileHandle = nullptr;
+#else
+        munmap(const_cast<char*>(_data), size_t(_size));
+#endif
+    }
+    _data = nullptr;
+    _size = 0;
+    _header = nullptr;
+    _keys = nullptr;
+    _values = nullptr;
+}
+
+
+const float* CoeffsFileMapping::Find(CoeffsFileKey key) const
+{
+    if (!IsOpen()) { return nullptr; }
+
+    const CoeffsFileKey* keysEnd = _keys + _header->nbEntries;
+    const CoeffsFileKey* it = lower_bound(_keys, keysEnd, key);
+    if (it == keysEnd || *it != key) { return nullptr; }
+
+    return _values + (it - _keys) * _header->nbValueComponents;
+}
+
+
+bool ReadCoeffsFileParams(const string& filename, CoeffsFileKind kind, CoeffsFileParams& params)
+{
+    ifstream file(filename, ios::binary);
+    CoeffsFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) { return false; }
+    if (memcmp(header.magic, "BFCD", 4) != 0 ||
+        header.version != COEFFS_FILE_VERSION ||
+        header.kind != uint32_t(kind))
+    {
+        return false;
+    }
+    params = header.params;
+    return true;
+}
+
+
+bool WriteCoeffsFile(
+    const string& filename,
+    CoeffsFileKind kind,
+    const CoeffsFileParams& params,
+    const vector<CoeffsFileKey>& keys,
+    const vector<float>& values,
+    uint32_t nbValueComponents)
+{
+    // sort entries by key
+    vector<size_t> order(keys.size());
+    iota(order.begin(), order.end(), size_t(0));
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    vector<CoeffsFileKey> sortedKeys(keys.size());
+    vector<float> sortedValues(values.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        sortedKeys[i] = keys[order[i]];
+        for (uint32_t c = 0; c < nbValueComponents; c++) {
+            sortedValues[i * nbValueComponents + c] = values[order[i] * nbValueComponents + c];
+        }
+    }
+
+    CoeffsFileHeader header = {};
+    memcpy(header.magic, "BFCD", 4);
+    header.version = COEFFS_FILE_VERSION;
+    header.kind = uint32_t(kind);
+    header.nbValueComponents = nbValueComponents;
+    header.nbEntries = sortedKeys.size();
+    header.params = params;
+
+    string tempFilename = filename + ".tmp";
+    ofstream file(tempFilename, ios::binary | ios::trunc);
+    if (!file) { return false; }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(sortedKeys.data()), sortedKeys.size() * sizeof(CoeffsFileKey));
+    file.write(reinterpret_cast<const char*>(sortedValues.data()), sortedValues.size() * sizeof(float));
+    file.close();
+    if (!file) { return false; }
+
+    error_code error;
+    filesystem::rename(tempFilename, filename, error);
+    return !error;
+}
@@ -0,0 +1,112 @@
+// Binary coefficient dictionary files. A file is a fixed header followed by a table of keys sorted
+// in increasing order and a parallel table of values, so that it can be memory-mapped and queried
+// in place with a binary search, without parsing or copying the dictionary.
+
+#ifndef COEFFSFILE_H
+#define COEFFSFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Incremented whenever the layout of the header or of the tables changes.
+const uint32_t COEFFS_FILE_VERSION = 5;
+
+enum class CoeffsFileKind : uint32_t { BB = 0, T = 1 };
+
+// How coefficients are integrated. Trapezoid samples the basis templates on a grid (text
+// dictionaries always use it), Analytic integrates the closed form of the bases.
+enum class CoeffsIntegration : int32_t { Trapezoid = 0, Analytic = 1 };
+
+
+// Parameters a dictionary was computed with. A file is only used if they match the application's
+// exactly, so dictionaries baked offline (see CoeffBaker.cpp) are never mixed with others.
+struct CoeffsFileParams {
+    int32_t minFreqLvl;
+    int32_t maxFreqLvl;
+    int32_t maxAnisoLvl;
+    uint32_t integralGridRes; // 0 with CoeffsIntegration::Analytic, which does not use it
+    float coeffSnapSize;
+    CoeffsIntegration integration;
+};
+
+inline bool operator==(const CoeffsFileParams& a, const CoeffsFileParams& b)
+{
+    return a.minFreqLvl == b.minFreqLvl &&
+        a.maxFreqLvl == b.maxFreqLvl &&
+        a.maxAnisoLvl == b.maxAnisoLvl &&
+        a.integralGridRes == b.integralGridRes &&
+        a.coeffSnapSize == b.coeffSnapSize &&
+        a.integration == b.integration;
+}
+
+
+struct CoeffsFileHeader {
+    char magic[4]; // always "BFCD"
+    uint32_t version; // COEFFS_FILE_VERSION
+    uint32_t kind; // CoeffsFileKind
+    uint32_t nbValueComponents; // 1 for BB coefficients, 2 for T coefficients
+    uint64_t nbEntries;
+    CoeffsFileParams params;
+};
+
+
+// Packed key, same as KeyTypeBB and KeyTypeT (see PackCoeffKey). Keys are sorted as integers.
+typedef uint64_t CoeffsFileKey;
+
+
+// Read-only memory mapping of a dictionary file.
+class CoeffsFileMapping {
+public:
+    CoeffsFileMapping() = default;
+    ~CoeffsFileMapping();
+    CoeffsFileMapping(const CoeffsFileMapping&) = delete;
+    CoeffsFileMapping& operator=(const CoeffsFileMapping&) = delete;
+
+    // Maps the file and checks its header. Returns false, leaving the mapping closed, if the file
+    // does not exist or does not match kind and params.
+    bool Open(const std::string& filename, CoeffsFileKind kind, const CoeffsFileParams& params);
+    void Close();
+
+    bool IsOpen() const { return _data != nullptr; }
+    uint64_t NbEntries() const { return IsOpen() ? _header->nbEntries : 0; }
+    uint32_t NbValueComponents() const { return IsOpen() ? _header->nbValueComponents : 0; }
+
+    // Sorted keys, and values with NbValueComponents() floats per key.
+    const CoeffsFileKey* Keys() const { return _keys; }
+    const float* Values() const { return _values; }
+
+    // Returns the values stored for key, or nullptr if the key is not in the file.
+    const float* Find(CoeffsFileKey key) const;
+
+private:
+    const char* _data = nullptr;
+    uint64_t _size = 0;
+    const CoeffsFileHeader* _header = nullptr;
+    const CoeffsFileKey* _keys = nullptr;
+    const float* _values = nullptr;
+
+#ifdef _WIN32
+    void* _fileHandle = nullptr;
+    void* _mappingHandle = nullptr;
+#endif
+};
+
+
+// Reads the parameters a dictionary file was computed with. Returns false if the file does not
+// exist or is not a dictionary of this kind and version.
+bool ReadCoeffsFileParams(const std::string& filename, CoeffsFileKind kind, CoeffsFileParams& params);
+
+
+// Writes a dictionary file. keys do not need to be sorted; values has nbValueComponents floats per
+// key. The file is first written next to filename and then moved in place, so a mapping of the
+// previous version of the file must be closed before calling this.
+bool WriteCoeffsFile(
+    const std::string& filename,
+    CoeffsFileKind kind,
+    const CoeffsFileParams& params,
+    const std::vector<CoeffsFileKey>& keys,
+    const std::vector<float>& values,
+    uint32_t nbValueComponents);
+
+#endif // COEFFSFILE_H
@@ -0,0 +1,102 @@
+// Hash map from packed 64-bit dictionary keys to coefficients. Open addressing with linear probing in
+// a flat array, so a lookup usually touches a single cache line instead of following node pointers.
+
+#ifndef COEFFSHASHMAP_H
+#define COEFFSHASHMAP_H
+
+#include <cstdint>
+#include <vector>
+
+template <class T>
+class CoeffsHashMap
+{
+public:
+    // Key marking empty slots. Packed keys never have all bits set (see PackCoeffKey).
+    static constexpr uint64_t EMPTY_KEY = ~uint64_t(0);
+
+    CoeffsHashMap() { Clear(); }
+
+    size_t Size() const { return _size; }
+    bool Empty() const { return _size == 0; }
+
+    void Clear() {
+        _keys.assign(MIN_CAPACITY, EMPTY_KEY);
+        _values.assign(MIN_CAPACITY, T());
+        _size = 0;
+    }
+
+    // Returns a pointer to the value of key, or nullptr if key is not in the map. Safe to call
+    // concurrently as long as the map is not modified.
+    const T* Find(uint64_t key) const {
+        size_t mask = _keys.size() - 1;
+        for (size_t slot = Hash(key) & mask; ; slot = (slot + 1) & mask) {
+            if (_keys[slot] == key) { return &_values[slot]; }
+            if (_keys[slot] == EMPTY_KEY) { return nullptr; }
+        }
+    }
+
+    // Inserts key with value. Returns false, leaving the map unchanged, if key is already present.
+    bool Insert(uint64_t key, const T& value) {
+        // keep load factor at most 1/2 so that probe sequences stay short
+        if (2 * (_size + 1) > _keys.size()) {
+            Rehash(2 * _keys.size());
+        }
+
+        size_t mask = _keys.size() - 1;
+        size_t slot = Hash(key) & mask;
+        while (_keys[slot] != EMPTY_KEY) {
+            if (_keys[slot] == key) { return false; }
+            slot = (slot + 1) & mask;
+        }
+        _keys[slot] = key;
+        _values[slot] = value;
+        _size++;
+        return true;
+    }
+
+    // Calls function(key, value) for all entries, in unspecified order.
+    template <class Function>
+    void ForEach(Function function) const {
+        for (size_t slot = 0; slot < _keys.size(); slot++) {
+            if (_keys[slot] != EMPTY_KEY) {
+                function(_keys[slot], _values[slot]);
+            }
+        }
+    }
+
+    // Finalizer of splitmix64. Packed keys differ mostly in a few low bits of each field, which this
+    // spreads over all bits.
+    static uint64_t Hash(uint64_t key) {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ull;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebull;
+        key ^= key >> 31;
+        return key;
+    }
+
+private:
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    void Rehash(size_t newCapacity) {
+        std::vector<uint64_t> oldKeys;
+        std::vector<T> oldValues;
+        oldKeys.swap(_keys);
+        oldValues.swap(_values);
+
+        _keys.assign(newCapacity, EMPTY_KEY);
+        _values.assign(newCapacity, T());
+        _size = 0;
+        for (size_t slot = 0; slot < oldKeys.size(); slot++) {
+            if (oldKeys[slot] != EMPTY_KEY) {
+                Insert(oldKeys[slot], oldValues[slot]);
+            }
+        }
+    }
+
+    std::vector<uint64_t> _keys;
+    std::vector<T> _values;
+    size_t _size;
+};
+
+#endif // COEFFSHASHMAP_H
@@ -138,6 +138,7 @@ void Application::ComputeVelocityGridForDisplay()
     _velocityField->populateWithFunction([](float /*x*/, float /*y*/) {return vec2(0); });
 
     for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
+        if (Sleeping(i)) { continue; }
         BasisFlow b = _basisFlowParams->getCpuData(i);
 
         _velocityField->addFunction(
@@ -146,10 +147,10 @@ void Application::ComputeVelocityGridForDisplay()
 
             vec2 vec(0);
             if (AllBitsSet(b.bitFlags, INTERIOR)) {
-                vec += VecObstacle_stretch(p, b);
+                vec += VecObstacle_stretch(p, b, _basisCoeffs.coeff[i]);
             }
 
-            vec += b.coeffBoundary * (vec2)(
+            vec += _basisCoeffs.coeffBoundary[i] * (vec2)(
                 TranslatedBasisEval(p, b.freqLvl, b.center)
                 );
 
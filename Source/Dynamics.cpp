@@ -4,9 +4,49 @@
 
 #include "glm/ext.hpp"
 
+#include <algorithm>
+#include <iostream>
+
 using namespace std;
 
-void Application::AddParticleForcesToBasisFlows()
+void Application::ProjectForcesAndBoundaryMotion()
+{
+    ComputeDynamicObstacleBoundaryMotionRHS();
+
+    MatBBSystem<MatBBReal> systems[2];
+    systems[0].vecX = _vecXBoundaryForces.get();
+    systems[0].vecB = _vecB.get();
+    systems[0].basisBitMask = BASIS_FLAGS::DYNAMIC_BOUNDARY_PROJECTION;
+    unsigned int nbSystems = 1;
+
+    if (_useForcesFromParticles) {
+        ComputeParticleForcesRHS();
+        systems[1].vecX = _vecXForces.get();
+        systems[1].vecB = _vecBForces.get();
+        systems[1].basisBitMask = BASIS_FLAGS::FORCE_PROJECTION;
+        nbSystems++;
+    }
+
+    // inverse to obtain base weights
+    InverseBBMatrices(systems, nbSystems);
+    if (_printSolverStats) {
+        std::cout << "boundary projection: " << systems[0].stats.nbIterations << " iterations, relative residual " <<
+            systems[0].stats.relativeResidual << endl;
+        if (nbSystems > 1) {
+            std::cout << "force projection: " << systems[1].stats.nbIterations << " iterations, relative residual " <<
+                systems[1].stats.relativeResidual << endl;
+        }
+    }
+
+    // sets the boundary coefficients of all basis flows, which need no reset between steps
+    MatBBReal* vecXBoundaryForcesPointer = _vecXBoundaryForces->getCpuDataPointer();
+    for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
+        _basisCoeffs.coeffBoundary[i] = float(vecXBoundaryForcesPointer[i]);
+    }
+}
+
+
+void Application::ComputeParticleForcesRHS()
 {
     // reset forces to zero
     _forceField->populateWithFunction([](float, float) {return vec2(0); });
@@ -44,7 +84,7 @@ void Application::AddParticleForcesToBasisFlows()
     }
 
     // project forces onto basis space  
-    double* vecBPointer = _vecB->getCpuDataPointer();
+    MatBBReal* vecBPointer = _vecBForces->getCpuDataPointer();
     for (unsigned int iBasis = 0; iBasis < _basisFlowParams->_nbElements; ++iBasis) {
         if (AllBitsSet(basisFlowParamsPointer[iBasis].bitFlags, BASIS_FLAGS::FORCE_PROJECTION)) {
             vecBPointer[iBasis] = IntegrateBasisGrid(basisFlowParamsPointer[iBasis], _forceField.get());
@@ -53,19 +93,20 @@ void Application::AddParticleForcesToBasisFlows()
             vecBPointer[iBasis] = 0;
         }
     }
+}
 
-    // inverse to obtain base weights
-    InverseBBMatrix(_vecXForces.get(), _vecB.get(), BASIS_FLAGS::FORCE_PROJECTION);
 
+void Application::AddParticleForcesToBasisFlows()
+{
     // add force weights to current basis weights
-    double* vecXForcesPointer = _vecXForces->getCpuDataPointer();
+    MatBBReal* vecXForcesPointer = _vecXForces->getCpuDataPointer();
     for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
-        basisFlowParamsPointer[i].coeff += _dt * float(vecXForcesPointer[i]);
+        _basisCoeffs.coeff[i] += _dt * float(vecXForcesPointer[i]);
     }
 }
 
 
-void Application::ProjectDynamicObstacleBoundaryMotion()
+void Application::ComputeDynamicObstacleBoundaryMotionRHS()
 {
     _forceField->populateWithFunction([=](float /*x*/, float /*y*/) { return vec2(0); });
     for (Obstacle* obs : _obstacles)
@@ -79,28 +120,176 @@ void Application::ProjectDynamicObstacleBoundaryMotion()
         }
     }
 
+    // without obstacle motion the projection is zero, which InverseBBMatrices returns right away
+    bool noMotion = _forceField->isZero();
+
     BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
-    double* vecBPointer = _vecB->getCpuDataPointer();
+    MatBBReal* vecBPointer = _vecB->getCpuDataPointer();
     for (unsigned int iBasis = 0; iBasis < _basisFlowParams->_nbElements; ++iBasis)
     {
         BasisFlow& b = basisFlowParamsPointer[iBasis];
-        vecBPointer[iBasis] = IntegrateBasisGrid(b, _forceField.get());
+        vecBPointer[iBasis] = noMotion ? 0 : IntegrateBasisGrid(b, _forceField.get());
     }
+}
 
-    InverseBBMatrix(_vecXBoundaryForces.get(), _vecB.get(), BASIS_FLAGS::DYNAMIC_BOUNDARY_PROJECTION);
 
-    double* vecXBoundaryForcesPointer = _vecXBoundaryForces->getCpuDataPointer();
-    for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
-        basisFlowParamsPointer[i].coeffBoundary = float(vecXBoundaryForcesPointer[i]);
+float Application::NewCenterProportion(const vec2& newCenter, const BasisFlow& bj, const vec2& interBasisDist)
+{
+    return glm::max<float>(0.f, (1.f - abs(newCenter.x - bj.center.x) / interBasisDist.x)) *
+        glm::max<float>(0.f, (1.f - abs(newCenter.y - bj.center.y) / interBasisDist.y));
+}
+
+
+// How a basis flow was advected, see Application::_transportModes
+enum TRANSPORT_MODES {
+    NOT_TRANSPORTED = 0,
+    TRANSPORTED_TO_NEIGHBORS = 1, // contributions in _transportContributions
+    TRANSPORTED_FAR = 2 // contributions in _farTransportContributions
+};
+
+
+void Application::UpdateIncomingTransportEntries()
+{
+    if (!_incomingTransportEntriesNeedUpdating) { return; }
+    _incomingTransportEntriesNeedUpdating = false;
+
+    const NeighborIds& transport = _intersectingBasesIdsTransport;
+    vector<unsigned int> rowSizes(transport.NbRows(), 0);
+    for (unsigned int j : transport.ids) {
+        rowSizes[j]++;
+    }
+    _incomingTransportEntries.Resize(rowSizes);
+    _transportEntrySources.resize(transport.ids.size());
+
+    // entries are visited by increasing position, so each row comes out sorted
+    vector<unsigned int> rowFill(_incomingTransportEntries.rowOffsets.begin(), _incomingTransportEntries.rowOffsets.end() - 1);
+    for (unsigned int i = 0; i < transport.NbRows(); i++) {
+        for (unsigned int k = transport.RowBegin(i); k < transport.RowEnd(i); k++) {
+            _incomingTransportEntries.ids[rowFill[transport.ids[k]]++] = k;
+            _transportEntrySources[k] = i;
+        }
+    }
+
+    // transport stencils, from the lattice indices of the basis flows
+    _basisLatticeIndices.resize(transport.NbRows());
+    for (const BasisLattice& lattice : _basisLattices) {
+        for (int iY = 0; iY < lattice.size.y; iY++) {
+            for (int iX = 0; iX < lattice.size.x; iX++) {
+                int basisId = lattice.ids[iY * lattice.size.x + iX];
+                if (basisId >= 0) {
+                    _basisLatticeIndices[basisId] = lattice.minIndex + ivec2(iX, iY);
+                }
+            }
+        }
+    }
+    _transportStencilEntries.assign(9 * transport.NbRows(), -1);
+    for (unsigned int i = 0; i < transport.NbRows(); i++) {
+        for (unsigned int k = transport.RowBegin(i); k < transport.RowEnd(i); k++) {
+            ivec2 offset = _basisLatticeIndices[transport.ids[k]] - _basisLatticeIndices[i];
+            if (abs(offset.x) <= 1 && abs(offset.y) <= 1) {
+                _transportStencilEntries[9 * i + 3 * (offset.y + 1) + offset.x + 1] = int(k);
+            }
+        }
     }
 }
 
 
-void Application::ComputeNewCenterProportions(vec2& newCenter, BasisFlow& bi, BasisFlow& bj, vec2& interBasisDist)
+void Application::UpdateIncomingDeformationEntries()
 {
-    float tempCoeff = glm::max<float>(0.f, (1.f - abs(newCenter.x - bj.center.x) / interBasisDist.x)) *
-        glm::max<float>(0.f, (1.f - abs(newCenter.y - bj.center.y) / interBasisDist.y));
-    bj.newCoeff += bi.coeff * tempCoeff;
+    if (!_incomingDeformationEntriesNeedUpdating) { return; }
+    _incomingDeformationEntriesNeedUpdating = false;
+
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    _deformationEntryOffsets.assign(1, 0);
+    vector<unsigned int> rowSizes(nbBasisFlows, 0);
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+        const NeighborCoeffs<float>& intersections = _intersectingBasesIdsDeformation[iRelFreq];
+        _deformationEntryOffsets.push_back(_deformationEntryOffsets.back() + (unsigned int)intersections.ids.size());
+        for (unsigned int j : intersections.ids) {
+            rowSizes[j]++;
+        }
+    }
+    _incomingDeformationEntries.Resize(rowSizes);
+    _deformationEntrySources.resize(_deformationEntryOffsets.back());
+
+    // Not exact substepping, but that's what we do by multiplying by dt anyways, so close enough I
+    // guess. Rates only depend on the frequency of the basis flows.
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    _basisTransferRates.resize(nbBasisFlows);
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        _basisTransferRates[i] = _dt * _explicitTransferSpeed *
+            powf(WavenumberBasis(basisFlowParamsPointer[i]), -_explicitTransferExponent) / _substepsDeformation;
+    }
+
+    // rows are filled in the order of the serial transfer loop: by sender, relative frequency, position
+    vector<unsigned int> rowFill(_incomingDeformationEntries.rowOffsets.begin(), _incomingDeformationEntries.rowOffsets.end() - 1);
+    for (unsigned int i = 0; i < nbBasisFlows; i++) {
+        for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+            const NeighborCoeffs<float>& intersections = _intersectingBasesIdsDeformation[iRelFreq];
+            for (unsigned int k = intersections.RowBegin(i); k < intersections.RowEnd(i); k++) {
+                unsigned int entry = _deformationEntryOffsets[iRelFreq] + k;
+                _incomingDeformationEntries.ids[rowFill[intersections.ids[k]]++] = entry;
+                _deformationEntrySources[entry] = i;
+            }
+        }
+    }
+}
+
+
+void Application::UpdateAwakeBasisSets()
+{
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+    int nbSimulatedBasisFlows = int(_simulatedBasisIds.size());
+    int nbTasks = glm::clamp(nbSimulatedBasisFlows / _minRowsPerSolverTask, 1, int(_solverThreadPool->NbThreads()));
+
+    // Each pass only writes the flags of its own basis flows, and only reads the flags of the
+    // previous pass. Basis flows that are not simulated send nothing and stay at 0.
+    _activeBasisFlags.assign(nbBasisFlows, 0);
+    _transportedBasisFlags.assign(nbBasisFlows, 0);
+    _sendingBasisFlags.assign(nbBasisFlows, 0);
+    _awakeBasisFlags.assign(nbBasisFlows, 0);
+    _basisDynamicsSweeps.all += 4;
+    _solverThreadPool->ParallelFor(0, nbSimulatedBasisFlows, nbTasks, [&](int id) {
+        unsigned int i = _simulatedBasisIds[id];
+        _activeBasisFlags[i] = _basisCoeffs.Quiescent(i, _sleepingCoeffThreshold) ? 0 : 1;
+    });
+    _solverThreadPool->ParallelFor(0, nbSimulatedBasisFlows, nbTasks, [&](int id) {
+        unsigned int j = _simulatedBasisIds[id];
+        bool transported = _activeBasisFlags[j] != 0;
+        for (unsigned int k = _incomingTransportEntries.RowBegin(j); !transported && k < _incomingTransportEntries.RowEnd(j); k++) {
+            transported = _activeBasisFlags[_transportEntrySources[_incomingTransportEntries.ids[k]]] != 0;
+        }
+        _transportedBasisFlags[j] = transported ? 1 : 0;
+    });
+    _solverThreadPool->ParallelFor(0, nbSimulatedBasisFlows, nbTasks, [&](int id) {
+        unsigned int j = _simulatedBasisIds[id];
+        bool sending = _transportedBasisFlags[j] != 0;
+        for (unsigned int k = _incomingDeformationEntries.RowBegin(j); !sending && k < _incomingDeformationEntries.RowEnd(j); k++) {
+            sending = _transportedBasisFlags[_deformationEntrySources[_incomingDeformationEntries.ids[k]]] != 0;
+        }
+        _sendingBasisFlags[j] = sending ? 1 : 0;
+    });
+    // everything the sending basis flows transport or transfer energy to is awake, so that it is
+    // received
+    _solverThreadPool->ParallelFor(0, nbSimulatedBasisFlows, nbTasks, [&](int id) {
+        unsigned int j = _simulatedBasisIds[id];
+        bool awake = _sendingBasisFlags[j] != 0;
+        for (unsigned int k = _incomingTransportEntries.RowBegin(j); !awake && k < _incomingTransportEntries.RowEnd(j); k++) {
+            awake = _sendingBasisFlags[_transportEntrySources[_incomingTransportEntries.ids[k]]] != 0;
+        }
+        for (unsigned int k = _incomingDeformationEntries.RowBegin(j); !awake && k < _incomingDeformationEntries.RowEnd(j); k++) {
+            awake = _sendingBasisFlags[_deformationEntrySources[_incomingDeformationEntries.ids[k]]] != 0;
+        }
+        _awakeBasisFlags[j] = awake ? 1 : 0;
+    });
+
+    _awakeBasisIds.clear();
+    for (unsigned int i : _simulatedBasisIds) {
+        if (_awakeBasisFlags[i]) {
+            _awakeBasisIds.push_back(i);
+        }
+    }
+    _basisDynamicsSweeps.simulated += 5;
 }
 
 
@@ -110,30 +299,47 @@ void Application::ComputeBasisAdvection()
 
     BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
 
-    for (uint i = 0; i < nbBasisFlows; i++) {
-        BasisFlow& bi = basisFlowParamsPointer[i];
-        bi.newCoeff = 0;
+    // only interior and boundary bases are advected, see _simulatedBasisIds, and only those that
+    // are awake, see _awakeBasisIds
+    UpdateActiveBasisSets();
+    UpdateIncomingTransportEntries();
+    UpdateIncomingDeformationEntries();
+    _basisDynamicsSweeps = BasisDynamicsSweeps();
+    UpdateAwakeBasisSets();
+    if (_printSleepingStats) {
+        std::cout << "awake basis flows: " << _awakeBasisIds.size() << " / " << _simulatedBasisIds.size() <<
+            " (" << 100.f * AwakeBasisFraction() << "%)" << endl;
     }
 
+    _basisVelocityWeights.resize(nbBasisFlows);
+    _transportModes.resize(nbBasisFlows);
+    _transportNewCenters.resize(nbBasisFlows);
+    _transportContributions.resize(_intersectingBasesIdsTransport.ids.size());
     for (uint i = 0; i < nbBasisFlows; i++) {
+        _basisVelocityWeights[i] = _basisCoeffs.VelocityWeight(i, _obstacleBoundaryFactor);
+    }
+    _basisDynamicsSweeps.all++;
 
-        BasisFlow& bi = basisFlowParamsPointer[i];
-        vec2 avgDisplacement(0);
+    // contributions sent by each sending basis flow. Basis flows only write to their own transport
+    // row. The other awake basis flows only receive, see UpdateAwakeBasisSets.
+    int nbThreads = int(_solverThreadPool->NbThreads());
+    int nbAwakeBasisFlows = int(_awakeBasisIds.size());
+    int nbTasks = glm::clamp(nbAwakeBasisFlows / _minRowsPerSolverTask, 1, nbThreads);
+    _solverThreadPool->ParallelFor(0, nbAwakeBasisFlows, nbTasks, [&](int id) {
 
-        if (!AllBitsSet(bi.bitFlags, INTERIOR) &&
-            !AllBitsSet(bi.bitFlags, DYNAMIC_BOUNDARY_PROJECTION))
-        {
-            continue;
-        }
+        unsigned int i = _awakeBasisIds[id];
+        if (!_sendingBasisFlags[i]) { return; }
+        const BasisFlow& bi = basisFlowParamsPointer[i];
 
         // compute displacement (I is transported by J)
-        vector<CoeffTDecompressedIntersectionInfo>& intersectionInfos = _coeffsTDecompressedIntersections[i];
-        for (CoeffTDecompressedIntersectionInfo& inter : intersectionInfos) {
-            avgDisplacement += inter.coeff * (basisFlowParamsPointer[inter.j].coeff + _obstacleBoundaryFactor * basisFlowParamsPointer[inter.j].coeffBoundary);
-        }
+        const NeighborCoeffs<vec2>& intersections = _coeffsTDecompressedIntersections;
+        unsigned int rowBegin = intersections.RowBegin(i);
+        vec2 avgDisplacement = _simdKernels.gatherDotVec2(intersections.coeffs.data() + rowBegin,
+            intersections.ids.data() + rowBegin, _basisVelocityWeights.data(), intersections.RowSize(i));
 
         // compute new center
         vec2 newCenter = bi.center + _dt * avgDisplacement;
+        _transportNewCenters[i] = newCenter;
 
         vec2 freqI(1 << bi.freqLvl.x, 1 << bi.freqLvl.y);
 
@@ -143,64 +349,68 @@ void Application::ComputeBasisAdvection()
             abs(newCenter.x - bi.center.x) > bi.supportHalfSize().x*0.5f*0.99 ||
             abs(newCenter.y - bi.center.y) > bi.supportHalfSize().y*0.5f*0.99
             ) {
-            // new center not located within immediate neighbours, must look further using basis acceleration grid
-            uvec2 minId(9999);
-            uvec2 maxId(0);
-            for (int iX = -1; iX <= 1; iX += 2) {
-                for (int iY = -1; iY <= 1; iY += 2) {
-                    vec2 corner = newCenter + vec2(iX, iY)*bi.supportHalfSize()*0.5f;
-                    uvec2 cellId;
-                    cellId.x = glm::clamp<int>(int(floor((corner.x - _domainLeft) / (_domainRight - _domainLeft)*_accelBasisRes)), 0, _accelBasisRes - 1);
-                    cellId.y = glm::clamp<int>(int(floor((corner.y - _domainBottom) / (_domainTop - _domainBottom)*_accelBasisRes)), 0, _accelBasisRes - 1);
-                    minId = glm::min<uint>(cellId, minId);
-                    maxId = glm::max<uint>(cellId, maxId);
-                }
-            }
-
-            for (uint iX = minId.x; iX <= maxId.x; iX++) {
-                for (uint iY = minId.y; iY <= maxId.y; iY++) {
-                    for (unsigned int basisId : *(_accelBasisCentersIds->getCpuData(iX, iY)))
-                    {
-                        BasisFlow& bj = basisFlowParamsPointer[basisId];
-                        if (bj.freqLvl == bi.freqLvl) {
-                            ComputeNewCenterProportions(newCenter, bi, bj, interBasisDist);
-                        }
-                    }
-                }
-            }
-
+            // new center not located within immediate neighbours, handled below
+            _transportModes[i] = TRANSPORTED_FAR;
         }
         else {
-            // new center within immediate neighbours, use stored neighbors
-            vector<unsigned int>* localIntersectingBasesIdsTransport = _intersectingBasesIdsTransport->getCpuData(i);
-            for (auto itJ = localIntersectingBasesIdsTransport->begin(); itJ != localIntersectingBasesIdsTransport->end(); ++itJ) {
-                BasisFlow& bj = basisFlowParamsPointer[*itJ];
-                ComputeNewCenterProportions(newCenter, bi, bj, interBasisDist);
+            // New center within immediate neighbours: only the four corners of the lattice cell
+            // containing it get a non-zero proportion, and the stencil gives their stored entries.
+            for (unsigned int k = _intersectingBasesIdsTransport.RowBegin(i); k < _intersectingBasesIdsTransport.RowEnd(i); k++) {
+                _transportContributions[k] = 0;
             }
+            ivec2 cell = ivec2(glm::floor((newCenter - bi.center) / interBasisDist));
+            for (int iY = 0; iY <= 1; iY++) {
+                for (int iX = 0; iX <= 1; iX++) {
+                    ivec2 offset = cell + ivec2(iX, iY);
+                    if (abs(offset.x) > 1 || abs(offset.y) > 1) { continue; }
+                    int k = _transportStencilEntries[9 * i + 3 * (offset.y + 1) + offset.x + 1];
+                    if (k < 0) { continue; }
+                    const BasisFlow& bj = basisFlowParamsPointer[_intersectingBasesIdsTransport.ids[k]];
+                    _transportContributions[k] = _basisCoeffs.coeff[i] * NewCenterProportion(newCenter, bj, interBasisDist);
+                }
+            }
+            _transportModes[i] = TRANSPORTED_TO_NEIGHBORS;
         }
-    }
-
-    // add transport cofficients and set new coefficients
-    for (uint i = 0; i < nbBasisFlows; i++) {
-        BasisFlow& bi = basisFlowParamsPointer[i];
+    });
+    _basisDynamicsSweeps.awake++;
+
+    // Basis flows moved beyond their transport neighbors find the corners of the lattice cell
+    // containing their new center in the lattice of their frequency level. This is rare, so it is
+    // done on one thread. Sleeping targets are woken and keep their own coefficient, but only send
+    // energy from the next step on.
+    _farTransportContributions.clear();
+    for (int id = 0; id < nbAwakeBasisFlows; id++) {
+        unsigned int i = _awakeBasisIds[id];
+        if (!_sendingBasisFlags[i] || _transportModes[i] != TRANSPORTED_FAR) { continue; }
+
+        const BasisFlow& bi = basisFlowParamsPointer[i];
+        vec2 newCenter = _transportNewCenters[i];
+        vec2 freqI(1 << bi.freqLvl.x, 1 << bi.freqLvl.y);
+        vec2 interBasisDist = 0.5f * 0.5f / freqI;
 
-        if (!AllBitsSet(bi.bitFlags, INTERIOR) &&
-            !AllBitsSet(bi.bitFlags, DYNAMIC_BOUNDARY_PROJECTION))
-        {
-            continue;
+        size_t iFreqLvl = upper_bound(_freqLvlBasisOffsets.begin(), _freqLvlBasisOffsets.end(), i) - _freqLvlBasisOffsets.begin() - 1;
+        const BasisLattice& lattice = _basisLattices[iFreqLvl];
+        ivec2 cell = _basisLatticeIndices[i] + ivec2(glm::floor((newCenter - bi.center) / interBasisDist));
+        for (int iY = 0; iY <= 1; iY++) {
+            for (int iX = 0; iX <= 1; iX++) {
+                int basisId = lattice.BasisId(cell + ivec2(iX, iY));
+                if (basisId < 0) { continue; }
+                const BasisFlow& bj = basisFlowParamsPointer[basisId];
+                _farTransportContributions.push_back(
+                    { (unsigned int)basisId, i, _basisCoeffs.coeff[i] * NewCenterProportion(newCenter, bj, interBasisDist) });
+                if (_simulatedBasisFlags[basisId] && !_awakeBasisFlags[basisId]) {
+                    _awakeBasisFlags[basisId] = 1;
+                    _awakeBasisIds.push_back(basisId);
+                }
+            }
         }
-
-        bi.coeff = bi.newCoeff;
-        bi.newCoeff = 0;
     }
+    _basisDynamicsSweeps.awake++;
+    // sources were visited in increasing order, which the stable sort keeps for each target
+    std::stable_sort(_farTransportContributions.begin(), _farTransportContributions.end(),
+        [](const FarTransportContribution& a, const FarTransportContribution& b) { return a.target < b.target; });
 
-    basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
-
-    //
-    // transfer energy from .coeff to .newCoeff
-    //
-
-    // normalize coefficients
+    // normalize energy transfer coefficients
     float transferCoeffs[_nbExplicitTransferFreqs];
     transferCoeffs[0] = _explicitTransfer_10;
     transferCoeffs[1] = _explicitTransfer_01;
@@ -210,57 +420,128 @@ void Application::ComputeBasisAdvection()
     transferCoeffs[5] = _explicitTransfer_m1m1;
 
     float sum = 0;
-    for (int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
         sum += transferCoeffs[iRelFreq];
     }
-    for (int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+    for (unsigned int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
         transferCoeffs[iRelFreq] /= sum;
     }
 
-    for (uint iSubstep = 0; iSubstep < _substepsDeformation; iSubstep++)
-    {
-        for (uint i = 0; i < nbBasisFlows; i++) {
-            BasisFlow& bi = basisFlowParamsPointer[i];
-            bi.newCoeff = 0;
-        }
-
-        for (uint i = 0; i < nbBasisFlows; i++) {
-
-            BasisFlow& bi = basisFlowParamsPointer[i];
-
-            if (!AllBitsSet(bi.bitFlags, INTERIOR) && !AllBitsSet(bi.bitFlags, DYNAMIC_BOUNDARY_PROJECTION)) { continue; }
+    // energy sent by sending basis flow i to its neighbors in one substep. Only reads the
+    // coefficient of i and only writes to the rows of i.
+    _deformationContributions.resize(_deformationEntryOffsets.back());
+    auto sendEnergy = [&](unsigned int i) {
+        float alpha = _basisTransferRates[i];
+        float alphaBiCoeff = alpha * _basisCoeffs.VelocityWeight(i, _obstacleBoundaryFactor);
 
-            float alpha = _dt * _explicitTransferSpeed * powf(WavenumberBasis(bi), -_explicitTransferExponent) / _substepsDeformation; // not exact substepping, but that's what we do by multiplying by dt anyways, so close enough I guess.
+        for (uint iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++)
+        {
+            const NeighborCoeffs<float>& intersections = _intersectingBasesIdsDeformation[iRelFreq];
+            float* contributions = _deformationContributions.data() + _deformationEntryOffsets[iRelFreq];
 
-            for (uint iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++)
-            {
-                vector<CoeffBBDecompressedIntersectionInfo>* localIntersectingBasesIdsDeformation = _intersectingBasesIdsDeformation[iRelFreq]->getCpuData(i);
+            for (unsigned int k = intersections.RowBegin(i); k < intersections.RowEnd(i); k++) {
+                contributions[k] = alphaBiCoeff * transferCoeffs[iRelFreq] * intersections.coeffs[k] / _coeffBBExplicitTransferSum_abs[i].coeffs[iRelFreq];
+            }
+        }
+    };
+
+    // Contributions received by each awake basis flow, added up by increasing source. Modes are only
+    // set for sending sources. Basis flows that did not send their coefficient keep it. Each basis
+    // flow then only reads and writes its own coefficient, so it directly sets its new coefficient
+    // and, if sending, sends its energy for the first substep of energy transfer, see below.
+    nbAwakeBasisFlows = int(_awakeBasisIds.size());
+    nbTasks = glm::clamp(nbAwakeBasisFlows / _minRowsPerSolverTask, 1, nbThreads);
+    _solverThreadPool->ParallelFor(0, nbAwakeBasisFlows, nbTasks, [&](int id) {
+        unsigned int j = _awakeBasisIds[id];
+
+        auto far = lower_bound(_farTransportContributions.begin(), _farTransportContributions.end(), j,
+            [](const FarTransportContribution& c, unsigned int target) { return c.target < target; });
+        auto farEnd = far;
+        while (farEnd != _farTransportContributions.end() && farEnd->target == j) {
+            farEnd++;
+        }
 
-                for (CoeffBBDecompressedIntersectionInfo& inter : *localIntersectingBasesIdsDeformation) {
-                    BasisFlow& bj = basisFlowParamsPointer[inter.j];
+        float newCoeff = _sendingBasisFlags[j] ? 0.f : _basisCoeffs.coeff[j];
+        unsigned int k = _incomingTransportEntries.RowBegin(j);
+        unsigned int kEnd = _incomingTransportEntries.RowEnd(j);
+        while (k < kEnd || far != farEnd) {
+            unsigned int entry = k < kEnd ? _incomingTransportEntries.ids[k] : 0;
+            if (far != farEnd && (k == kEnd || far->source < _transportEntrySources[entry])) {
+                newCoeff += far->coeff;
+                far++;
+            }
+            else {
+                unsigned int i = _transportEntrySources[entry];
+                if (_sendingBasisFlags[i] && _transportModes[i] == TRANSPORTED_TO_NEIGHBORS) {
+                    newCoeff += _transportContributions[entry];
+                }
+                k++;
+            }
+        }
+        _basisCoeffs.coeff[j] = newCoeff;
 
-                    float alphaBiCoeff;
-                    alphaBiCoeff = alpha * (bi.coeff + _obstacleBoundaryFactor * bi.coeffBoundary);
+        if (_substepsDeformation > 0 && _sendingBasisFlags[j]) {
+            sendEnergy(j);
+        }
+    });
+    _basisDynamicsSweeps.awake++;
 
-                    bj.newCoeff += alphaBiCoeff * transferCoeffs[iRelFreq] * inter.coeff / _coeffBBExplicitTransferSum_abs[i].coeffs[iRelFreq];
+    //
+    // transfer energy between neighboring basis flows
+    //
 
-                    bi.newCoeff -= alpha * bi.coeff * transferCoeffs[iRelFreq] * abs(inter.coeff) / _coeffBBExplicitTransferSum_abs[i].coeffs[iRelFreq];
+    // Each substep, once the sending basis flows have sent their energy, each awake basis flow
+    // adds up what it receives and what it sends away, in the order of a serial loop over senders.
+    // All the basis flows they send to are awake, see UpdateAwakeBasisSets.
+    for (uint iSubstep = 0; iSubstep < _substepsDeformation; iSubstep++)
+    {
+        if (iSubstep > 0) {
+            _solverThreadPool->ParallelFor(0, nbAwakeBasisFlows, nbTasks, [&](int id) {
+                unsigned int i = _awakeBasisIds[id];
+                if (_sendingBasisFlags[i]) {
+                    sendEnergy(i);
                 }
-            }
+            });
+            _basisDynamicsSweeps.awake++;
         }
 
-        // set .newCoeff as .coeff
-        for (uint i = 0; i < nbBasisFlows; i++) {
-            BasisFlow& bi = basisFlowParamsPointer[i];
+        _solverThreadPool->ParallelFor(0, nbAwakeBasisFlows, nbTasks, [&](int id) {
+            unsigned int j = _awakeBasisIds[id];
 
-            if (!AllBitsSet(bi.bitFlags, INTERIOR) &&
-                !AllBitsSet(bi.bitFlags, DYNAMIC_BOUNDARY_PROJECTION))
-            {
-                continue;
+            // energy sent away by bj, which the serial loop subtracts while visiting bj
+            auto subtractSent = [&](float newCoeff) {
+                float alpha = _basisTransferRates[j];
+                for (uint iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
+                    const NeighborCoeffs<float>& intersections = _intersectingBasesIdsDeformation[iRelFreq];
+                    for (unsigned int k = intersections.RowBegin(j); k < intersections.RowEnd(j); k++) {
+                        newCoeff -= alpha * _basisCoeffs.coeff[j] * transferCoeffs[iRelFreq] * abs(intersections.coeffs[k]) / _coeffBBExplicitTransferSum_abs[j].coeffs[iRelFreq];
+                    }
+                }
+                return newCoeff;
+            };
+
+            // basis flows that do not send count as having subtracted it already
+            float newCoeff = 0;
+            bool sentSubtracted = !_sendingBasisFlags[j];
+            for (unsigned int k = _incomingDeformationEntries.RowBegin(j); k < _incomingDeformationEntries.RowEnd(j); k++) {
+                unsigned int entry = _incomingDeformationEntries.ids[k];
+                unsigned int i = _deformationEntrySources[entry];
+                if (!sentSubtracted && i > j) {
+                    newCoeff = subtractSent(newCoeff);
+                    sentSubtracted = true;
+                }
+                if (_sendingBasisFlags[i]) {
+                    newCoeff += _deformationContributions[entry];
+                }
+            }
+            if (!sentSubtracted) {
+                newCoeff = subtractSent(newCoeff);
             }
 
-            bi.coeff += bi.newCoeff;
-        }
+            // only bj's own coefficient was read, so it can be updated here
+            _basisCoeffs.coeff[j] += newCoeff;
+        });
+        _basisDynamicsSweeps.awake++;
     }
 }
 
@@ -79,6 +79,10 @@ bool Application::Init() {
         return false;
     }
 
+    if (_runBenchmarks) {
+        RunBenchmarks();
+    }
+
     return true;
 }
 
@@ -14,15 +14,25 @@ bool Application::Init_BasisFlows() {
     std::cout << "Computing basis coefficients..." << endl;
     PrintTime();
 
-    stringstream ss;
-
-    ss.str("");
-    ss << "Data/Coeffs" << "-" << _maxFreqLvl << "-" << _maxAnisoLvl << "-BB.txt";
-    LoadCoeffsBB(ss.str());
+    // Use binary dictionaries when present. Otherwise, load the text dictionaries, which are then
+    // converted to binary dictionaries when saving coefficients below. Text dictionaries were
+    // integrated with the trapezoid rule, so they are only used with that method.
+    bool useTextCoeffs = _coeffsIntegration == CoeffsIntegration::Trapezoid;
+    if (!MapCoeffsFileBB(CoeffsFilename("BB", "bin")) && useTextCoeffs) {
+        LoadCoeffsBB(CoeffsFilename("BB", "txt"));
+        _newBBCoeffComputed = !_coeffsBB.Empty();
+    }
+    if (!MapCoeffsFileT(CoeffsFilename("T", "bin")) && useTextCoeffs) {
+        LoadCoeffsT(CoeffsFilename("T", "txt"));
+        _newTCoeffComputed = !_coeffsT.Empty();
+    }
 
-    ss.str("");
-    ss << "Data/Coeffs" << "-" << _maxFreqLvl << "-" << _maxAnisoLvl << "-T.txt";
-    LoadCoeffsT(ss.str());
+    // restore the basis setup of a previous run with the same parameters
+    if (!_headless && LoadBasisSnapshot(BasisSnapshotFilename())) {
+        std::cout << "Basis setup done." << endl;
+        PrintTime();
+        return true;
+    }
 
     // compute possible frequencies
     _freqLvls.clear();
@@ -51,11 +61,15 @@ bool Application::Init_BasisFlows() {
     //
 
     _basisFlowParams->resize(0);
+    _basisLattices.clear();
+    _freqLvlBasisOffsets.clear();
 
     unsigned int nbBasesTested = 0;
 
     for (int iFreqLvl = 0; iFreqLvl < _freqLvls.size(); iFreqLvl++)
     {
+        _freqLvlBasisOffsets.push_back(_basisFlowParams->_nbElements);
+
         ivec2 freqLvl = _freqLvls[iFreqLvl];
         ivec2 freq = ivec2(powf(2.f, float(freqLvl.x)), powf(2.f, float(freqLvl.y)));
 
@@ -76,6 +90,17 @@ bool Application::Init_BasisFlows() {
             newOrthogonalBasisGroups.push_back(newGroup);
         }
 
+        // Extra offsets are half strides, so all centers of this frequency lie on a lattice with
+        // spacing stride/2, where extra offset (0.5,0) of offset (iOffsetX,iOffsetY) has lattice index
+        // (2*iOffsetX+1, 2*iOffsetY).
+        BasisLattice lattice;
+        lattice.freqLvl = freqLvl;
+        lattice.origin = origin;
+        lattice.spacing = _lengthLvl0 * 0.5f * stride;
+        lattice.minIndex = ivec2(2 * offsetMinX, 2 * offsetMinY);
+        lattice.size = ivec2(2 * (offsetMaxX - offsetMinX + 1), 2 * (offsetMaxY - offsetMinY + 1));
+        lattice.ids.assign(lattice.size.x * lattice.size.y, -1);
+
         for (int iOffsetX = offsetMinX; iOffsetX <= offsetMaxX; iOffsetX++) {
             for (int iOffsetY = offsetMinY; iOffsetY <= offsetMaxY; iOffsetY++) {
 
@@ -92,18 +117,38 @@ bool Application::Init_BasisFlows() {
                         // Add to basis groups
                         newOrthogonalBasisGroups[iOffset].push_back(_basisFlowParams->_nbElements - 1);
                         newSameBasisTemplateGroup.push_back(_basisFlowParams->_nbElements - 1);
+
+                        lattice.SetBasisId(
+                            ivec2(2 * iOffsetX + int(2.f * extraOffset.x), 2 * iOffsetY + int(2.f * extraOffset.y)),
+                            _basisFlowParams->_nbElements - 1);
                     }
                 }
             }
         }
 
+        _basisLattices.push_back(lattice);
+
         for (unsigned int iOffset = 0; iOffset < nbOffsets; iOffset++) {
             _orthogonalBasisGroupIds.push_back(newOrthogonalBasisGroups[iOffset]);
         }
     }
 
+    _freqLvlBasisOffsets.push_back(_basisFlowParams->_nbElements);
+
     unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
 
+    // In lazy mode, only the coarse frequency levels are simulated at first. Frequency levels are
+    // ordered by wavenumber, so they are a prefix of _freqLvls.
+    unsigned int nbActiveFreqLvls = (unsigned int)_freqLvls.size();
+    if (_lazyCoeffs && !_headless) {
+        nbActiveFreqLvls = 0;
+        while (nbActiveFreqLvls < _freqLvls.size() &&
+            glm::max(_freqLvls[nbActiveFreqLvls].x, _freqLvls[nbActiveFreqLvls].y) <= _lazyCoeffsInitialFreqLvl) {
+            nbActiveFreqLvls++;
+        }
+    }
+    _nbActiveBasisFlows = _freqLvlBasisOffsets[nbActiveFreqLvls];
+
     // compute basis norm squared
     BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
     for (unsigned int iBasis = 0; iBasis < nbBasisFlows; ++iBasis) {
@@ -111,32 +156,12 @@ bool Application::Init_BasisFlows() {
         b.normSquared = MatBBCoeff(b, b);
     }
 
-    // resize matrix computation vectors
-    _vecX->resize(nbBasisFlows);
-    _vecXForces->resize(nbBasisFlows);
-    _vecXBoundaryForces->resize(nbBasisFlows);
-    _vecB->resize(nbBasisFlows);
-
-    // fill basis centers acceleration structure
-    for (unsigned int iBasis = 0; iBasis < nbBasisFlows; ++iBasis) {
-        BasisFlow b = _basisFlowParams->getCpuData(iBasis);
-        uint idX = glm::clamp<int>(
-            int(floor((b.center.x - _domainLeft) / (_domainRight - _domainLeft)*_accelBasisRes)),
-            0, _accelBasisRes - 1);
-        uint idY = glm::clamp<int>(
-            int(floor((b.center.y - _domainBottom) / (_domainTop - _domainBottom)*_accelBasisRes)),
-            0, _accelBasisRes - 1);
-        _accelBasisCentersIds->getCpuData(idX, idY)->push_back(iBasis);
-    }
-
-    // precompute intersection bases (including themselves)
-    _intersectingBasesIds->resize(nbBasisFlows);
-    _intersectingBasesIdsTransport->resize(nbBasisFlows);
+    SetupBasisFlowBuffers();
 
-    for (unsigned int i = 0; i < _basisFlowParams->_nbElements; i++) {
-        _intersectingBasesIds->setCpuData(i, new vector<unsigned int>);
-        _intersectingBasesIdsTransport->setCpuData(i, new vector<unsigned int>);
-    }
+    // precompute intersection bases (including themselves). Rows are built separately in parallel,
+    // then packed in CSR format.
+    vector<vector<unsigned int>> intersectingBasesIds(nbBasisFlows);
+    vector<vector<unsigned int>> intersectingBasesIdsTransport(nbBasisFlows);
 
     basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
 
@@ -147,130 +172,121 @@ bool Application::Init_BasisFlows() {
         basisSupports.push_back(b.getSupport());
     }
 
-    // compute basis intersections and transport
-    for (unsigned int iBasis1 = 0; iBasis1 < nbBasisFlows; ++iBasis1) {
+    // compute basis intersections and transport. Instead of testing all pairs of bases, each basis is
+    // only tested against the bases of each frequency level whose lattice centers are close enough
+    // for their supports to overlap.
+    ParallelFor(0, int(nbBasisFlows), [&](int iBasis1) {
         BasisFlow& b1 = basisFlowParamsPointer[iBasis1];
         BasisSupport& b1Support = basisSupports[iBasis1];
+        vector<unsigned int>* localIntersectingBasesIds = &intersectingBasesIds[iBasis1];
+        vector<unsigned int>* localIntersectingBasesIdsTransport = &intersectingBasesIdsTransport[iBasis1];
 
         vec2 b1TransportLimits = b1.supportHalfSize()*0.5f*1.01f;
 
-        for (unsigned int iBasis2 = iBasis1 + 1; iBasis2 < nbBasisFlows; ++iBasis2) {
-            BasisFlow& b2 = basisFlowParamsPointer[iBasis2];
-            BasisSupport& b2Support = basisSupports[iBasis2];
-
-            if (!IntersectionInteriorEmpty(b1Support, b2Support))
-            {
-                _intersectingBasesIds->getCpuData(iBasis1)->push_back(iBasis2);
-                _intersectingBasesIds->getCpuData(iBasis2)->push_back(iBasis1);
-
-                // transport
-                if (
-                    b2.freqLvl == b1.freqLvl &&
-                    abs(b2.center.x - b1.center.x) <= b1TransportLimits.x &&
-                    abs(b2.center.y - b1.center.y) <= b1TransportLimits.y
-                    )
-                {
-                    _intersectingBasesIdsTransport->getCpuData(iBasis1)->push_back(iBasis2);
-                    _intersectingBasesIdsTransport->getCpuData(iBasis2)->push_back(iBasis1);
+        for (const BasisLattice& lattice : _basisLattices) {
+            vec2 maxCenterDist = b1.supportHalfSize() + BasisFlow(lattice.freqLvl, vec2(0)).supportHalfSize();
+            ivec2 minIndex = ivec2(glm::floor((b1.center - maxCenterDist - lattice.origin) / lattice.spacing));
+            ivec2 maxIndex = ivec2(glm::ceil((b1.center + maxCenterDist - lattice.origin) / lattice.spacing));
+
+            for (int iX = minIndex.x; iX <= maxIndex.x; iX++) {
+                for (int iY = minIndex.y; iY <= maxIndex.y; iY++) {
+                    int iBasis2 = lattice.BasisId(ivec2(iX, iY));
+                    if (iBasis2 < 0 || iBasis2 == iBasis1) { continue; }
+
+                    BasisFlow& b2 = basisFlowParamsPointer[iBasis2];
+                    BasisSupport& b2Support = basisSupports[iBasis2];
+
+                    if (!IntersectionInteriorEmpty(b1Support, b2Support))
+                    {
+                        localIntersectingBasesIds->push_back(iBasis2);
+
+                        // transport
+                        if (
+                            b2.freqLvl == b1.freqLvl &&
+                            abs(b2.center.x - b1.center.x) <= b1TransportLimits.x &&
+                            abs(b2.center.y - b1.center.y) <= b1TransportLimits.y
+                            )
+                        {
+                            localIntersectingBasesIdsTransport->push_back(iBasis2);
+                        }
+                    }
                 }
-
             }
         }
-        // include itself in intersections
-        _intersectingBasesIds->getCpuData(iBasis1)->push_back(iBasis1);
-        _intersectingBasesIdsTransport->getCpuData(iBasis1)->push_back(iBasis1);
 
-        if ((iBasis1 + 1) % 1000 == 0) { std::cout << "Basis intersection: " << iBasis1 + 1 << "/" << _basisFlowParams->_nbElements << endl; }
-    }
+        // sort sets by ID number, and include itself in intersections
+        localIntersectingBasesIds->push_back(iBasis1);
+        std::sort(localIntersectingBasesIds->begin(), localIntersectingBasesIds->end());
+        std::sort(localIntersectingBasesIdsTransport->begin(), localIntersectingBasesIdsTransport->end());
+        localIntersectingBasesIdsTransport->push_back(iBasis1);
+    });
+    _intersectingBasesIds.Assign(intersectingBasesIds);
+    _intersectingBasesIdsTransport.Assign(intersectingBasesIdsTransport);
+    _incomingTransportEntriesNeedUpdating = true;
+    intersectingBasesIds.clear();
+    intersectingBasesIdsTransport.clear();
     std::cout << "Basis intersection: " << _basisFlowParams->_nbElements << "/" << _basisFlowParams->_nbElements << endl;
 
-    // sort sets by ID number
-    for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
-        std::sort(_intersectingBasesIds->getCpuData(i)->begin(),
-            _intersectingBasesIds->getCpuData(i)->end());
-    }
-
     basisSupports.clear();
 
-    // precompute decompressed T coefficients
-    std::cout << "computing decompressed coefficients T..." << endl;
-    _coeffsTDecompressedIntersections.clear();
-    _coeffsTDecompressedIntersections.resize(nbBasisFlows);
-    for (unsigned int i = 0; i < nbBasisFlows; i++) {
-        vector<CoeffTDecompressedIntersectionInfo>& intersectionInfos = _coeffsTDecompressedIntersections[i];
-        vector<unsigned int>* localIntersectingBasesIds = _intersectingBasesIds->getCpuData(i);
-        for (auto itJ = localIntersectingBasesIds->begin(); itJ != localIntersectingBasesIds->end(); ++itJ) {
-            vec2 coeff = MatTCoeff(i, *itJ);
-            intersectionInfos.push_back(CoeffTDecompressedIntersectionInfo(*itJ, coeff));
-        }
+    // compute all missing dictionary coefficients in parallel. The decompression below then only
+    // reads the dictionaries, so its rows can be filled in parallel.
+    PrecomputeCoeffsT(basisFlowParamsPointer, _nbActiveBasisFlows);
+    PrecomputeCoeffsBB(basisFlowParamsPointer, _nbActiveBasisFlows);
 
-        if ((i + 1) % 1000 == 0) {
-            std::cout << "decompressed T : " << i + 1 << " / " << nbBasisFlows << endl;
-        }
-    }
-    std::cout << "decompressed T : " << nbBasisFlows << " / " << nbBasisFlows << endl;
-
-    // precompute decompressed BB coefficients
-    std::cout << "computing decompressed coefficients BB..." << endl;
-    _coeffsBBDecompressedIntersections.clear();
-    _coeffsBBDecompressedIntersections.resize(nbBasisFlows);
-    _coeffBBExplicitTransferSum_abs.clear();
-    _coeffBBExplicitTransferSum_abs.resize(nbBasisFlows);
-    for (int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
-        _intersectingBasesIdsDeformation[iRelFreq]->resize(nbBasisFlows);
-        for (unsigned int i = 0; i < _basisFlowParams->_nbElements; i++) {
-            _intersectingBasesIdsDeformation[iRelFreq]->setCpuData(i, new vector<CoeffBBDecompressedIntersectionInfo>);
-        }
-    }
-
-    for (unsigned int i = 0; i < nbBasisFlows; i++) {
-        vector<CoeffBBDecompressedIntersectionInfo>& intersectionInfos = _coeffsBBDecompressedIntersections[i];
-        vector<unsigned int>* localIntersectingBasesIds = _intersectingBasesIds->getCpuData(i);
-        float explicitTransferTotalWeight_abs[_nbExplicitTransferFreqs] = { 0 };
-
-        ivec2 freqI = _basisFlowParams->getCpuData(i).freqLvl;
-        for (auto it = localIntersectingBasesIds->begin(); it != localIntersectingBasesIds->end(); ++it) {
-            if (*it == i) { continue; }
-            float coeff = float(MatBBCoeff(i, (*it)));
-            intersectionInfos.push_back(CoeffBBDecompressedIntersectionInfo((*it), coeff));
-
-            ivec2 freqJ = _basisFlowParams->getCpuData(*it).freqLvl;
-            for (int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
-                if (freqJ - freqI == _explicitTransferFreqs[iRelFreq]) {
-                    explicitTransferTotalWeight_abs[iRelFreq] += abs(coeff);
-                    _intersectingBasesIdsDeformation[iRelFreq]->getCpuData(i)->push_back(CoeffBBDecompressedIntersectionInfo((*it), coeff));
-                }
-            }
-        }
-
-        for (int iRelFreq = 0; iRelFreq < _nbExplicitTransferFreqs; iRelFreq++) {
-            _coeffBBExplicitTransferSum_abs[i].coeffs[iRelFreq] = explicitTransferTotalWeight_abs[iRelFreq];
-        }
+    filesystem::create_directory("Data");
 
-        if ((i + 1) % 1000 == 0) {
-            std::cout << "Decompressed BB : " << i + 1 << " / " << nbBasisFlows << endl;
-        }
+    // the coefficient baker only needs the dictionaries
+    if (_headless) {
+        SaveCoeffsFileBB(CoeffsFilename("BB", "bin"));
+        SaveCoeffsFileT(CoeffsFilename("T", "bin"));
+        return true;
     }
-    std::cout << "Decompressed BB : " << nbBasisFlows << " / " << nbBasisFlows << endl;
+
+    std::cout << "computing decompressed coefficients..." << endl;
+    DecompressedCoeffs decompressedCoeffs;
+    DecompressCoeffs(basisFlowParamsPointer, _nbActiveBasisFlows, decompressedCoeffs);
+    SwapDecompressedCoeffs(decompressedCoeffs);
+    std::cout << "Decompressed coefficients : " << _nbActiveBasisFlows << " / " << nbBasisFlows << endl;
 
     unsigned int minNbBases = -1;
     unsigned int maxNbBases = 0;
     for (unsigned int i = 0; i < nbBasisFlows; i++) {
-        minNbBases = glm::min(minNbBases, (unsigned int)_coeffsBBDecompressedIntersections[i].size());
-        maxNbBases = glm::max(maxNbBases, (unsigned int)_coeffsBBDecompressedIntersections[i].size());
+        minNbBases = glm::min(minNbBases, _coeffsBBDecompressedIntersections.RowSize(i));
+        maxNbBases = glm::max(maxNbBases, _coeffsBBDecompressedIntersections.RowSize(i));
     }
 
-    ss.str("");
-    ss << "Data/Coeffs" << "-" << _maxFreqLvl << "-" << _maxAnisoLvl << "-BB.txt";
-    filesystem::create_directory("Data");
-    SaveCoeffsBB(ss.str());
+    SaveCoeffsFileBB(CoeffsFilename("BB", "bin"));
+    SaveCoeffsFileT(CoeffsFilename("T", "bin"));
 
-    ss.str("");
-    ss << "Data/Coeffs" << "-" << _maxFreqLvl << "-" << _maxAnisoLvl << "-T.txt";
-    SaveCoeffsT(ss.str());
+    if (_nbActiveBasisFlows < nbBasisFlows) {
+        StartLazyCoeffs();
+    }
+    else {
+        SaveBasisSnapshot(BasisSnapshotFilename());
+    }
 
     std::cout << "Basis setup done." << endl;
     PrintTime();
 
     return true;
+}
+
+
+void Application::SetupBasisFlowBuffers() {
+
+    unsigned int nbBasisFlows = _basisFlowParams->_nbElements;
+
+    // resize matrix computation vectors
+    _vecX->resize(nbBasisFlows);
+    _vecXForces->resize(nbBasisFlows);
+    _vecXBoundaryForces->resize(nbBasisFlows);
+    _vecB->resize(nbBasisFlows);
+    _vecBForces->resize(nbBasisFlows);
+
+    _basisCoeffs.Reset(nbBasisFlows);
+
+    if (!_solverThreadPool) {
+        _solverThreadPool = make_unique<ThreadPool>();
+    }
 }
\ No newline at end of file
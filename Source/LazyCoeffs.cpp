@@ -0,0 +1,91 @@
+#include "Application.h"
+
+#include <iostream>
+
+using namespace std;
+
+void Application::StartLazyCoeffs()
+{
+    // The worker only needs the frequencies and centers of the bases, which the simulation does not
+    // modify, but it gets its own copy since the simulation writes other fields of the same bases.
+    BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    vector<BasisFlow> bases(basisFlowParamsPointer, basisFlowParamsPointer + _basisFlowParams->_nbElements);
+
+    unsigned int nbActiveFreqLvls = 0;
+    while (_freqLvlBasisOffsets[nbActiveFreqLvls] < _nbActiveBasisFlows) {
+        nbActiveFreqLvls++;
+    }
+
+    std::cout << "computing coefficients of " << _freqLvls.size() - nbActiveFreqLvls <<
+        " frequency levels in the background..." << endl;
+
+    _lazyCoeffsStopRequested = false;
+    _lazyCoeffsThread = std::thread(&Application::LazyCoeffsWorker, this, std::move(bases), nbActiveFreqLvls);
+}
+
+
+// Runs on the lazy coefficients thread. Once started, it is the only user of the coefficient
+// dictionaries, while the simulation only reads the decompressed coefficients it publishes.
+void Application::LazyCoeffsWorker(vector<BasisFlow> bases, unsigned int nbActiveFreqLvls)
+{
+    for (unsigned int iFreqLvl = nbActiveFreqLvls; iFreqLvl < _freqLvls.size(); iFreqLvl++) {
+        if (_lazyCoeffsStopRequested) { break; }
+
+        // coefficients of a level involve all coarser levels, so the decompressed coefficients of all
+        // active bases are rebuilt
+        unsigned int nbActiveBasisFlows = _freqLvlBasisOffsets[iFreqLvl + 1];
+        PrecomputeCoeffsT(bases.data(), nbActiveBasisFlows);
+        PrecomputeCoeffsBB(bases.data(), nbActiveBasisFlows);
+
+        unique_ptr<DecompressedCoeffs> decompressedCoeffs = make_unique<DecompressedCoeffs>();
+        DecompressCoeffs(bases.data(), nbActiveBasisFlows, *decompressedCoeffs);
+
+        lock_guard<mutex> lock(_lazyCoeffsMutex);
+        _lazyCoeffsReady = std::move(decompressedCoeffs);
+        _lazyCoeffsReadyNbActiveBasisFlows = nbActiveBasisFlows;
+    }
+
+    // keep the coefficients computed so far, even when stopped early
+    SaveCoeffsFileBB(CoeffsFilename("BB", "bin"));
+    SaveCoeffsFileT(CoeffsFilename("T", "bin"));
+}
+
+
+void Application::UpdateLazyCoeffs()
+{
+    unique_ptr<DecompressedCoeffs> decompressedCoeffs;
+    unsigned int nbActiveBasisFlows;
+    {
+        lock_guard<mutex> lock(_lazyCoeffsMutex);
+        if (!_lazyCoeffsReady) { return; }
+        decompressedCoeffs = std::move(_lazyCoeffsReady);
+        nbActiveBasisFlows = _lazyCoeffsReadyNbActiveBasisFlows;
+    }
+
+    SwapDecompressedCoeffs(*decompressedCoeffs);
+    _nbActiveBasisFlows = nbActiveBasisFlows;
+    std::cout << "simulating " << _nbActiveBasisFlows << " / " << _basisFlowParams->_nbElements <<
+        " basis flows" << endl;
+
+    if (_nbActiveBasisFlows == _basisFlowParams->_nbElements) {
+        SaveBasisSnapshot(BasisSnapshotFilename());
+    }
+}
+
+
+void Application::WaitLazyCoeffs()
+{
+    if (_lazyCoeffsThread.joinable()) {
+        _lazyCoeffsThread.join();
+    }
+    UpdateLazyCoeffs();
+}
+
+
+void Application::StopLazyCoeffs()
+{
+    _lazyCoeffsStopRequested = true;
+    if (_lazyCoeffsThread.joinable()) {
+        _lazyCoeffsThread.join();
+    }
+}
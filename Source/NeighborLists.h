@@ -0,0 +1,64 @@
+// Neighbor lists of all basis flows in compressed sparse row (CSR) format. The neighbors of basis i
+// are entries RowBegin(i) to RowEnd(i)-1 of flat arrays shared by all bases, so a sweep over the
+// bases reads memory sequentially instead of following one heap allocation per basis. Neighbor ids
+// and coefficients are separate arrays (structure of arrays), so loops only load what they use.
+
+#ifndef NEIGHBORLISTS_H
+#define NEIGHBORLISTS_H
+
+#include <algorithm>
+#include <vector>
+
+struct NeighborIds {
+    std::vector<unsigned int> rowOffsets = { 0 }; // NbRows() + 1 entries
+    std::vector<unsigned int> ids;
+
+    unsigned int NbRows() const { return (unsigned int)(rowOffsets.size() - 1); }
+    unsigned int RowBegin(unsigned int i) const { return rowOffsets[i]; }
+    unsigned int RowEnd(unsigned int i) const { return rowOffsets[i + 1]; }
+    unsigned int RowSize(unsigned int i) const { return rowOffsets[i + 1] - rowOffsets[i]; }
+
+    // Sets the number of rows and the size of each row. The entries of each row must then be set.
+    void Resize(const std::vector<unsigned int>& rowSizes) {
+        rowOffsets.resize(rowSizes.size() + 1);
+        rowOffsets[0] = 0;
+        for (size_t i = 0; i < rowSizes.size(); i++) {
+            rowOffsets[i + 1] = rowOffsets[i] + rowSizes[i];
+        }
+        ids.resize(rowOffsets.back());
+    }
+
+    // Sets the rows to rows
+    void Assign(const std::vector<std::vector<unsigned int>>& rows) {
+        std::vector<unsigned int> rowSizes(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            rowSizes[i] = (unsigned int)rows[i].size();
+        }
+        Resize(rowSizes);
+        for (size_t i = 0; i < rows.size(); i++) {
+            std::copy(rows[i].begin(), rows[i].end(), ids.begin() + rowOffsets[i]);
+        }
+    }
+
+    size_t MemoryBytes() const {
+        return rowOffsets.capacity() * sizeof(unsigned int) + ids.capacity() * sizeof(unsigned int);
+    }
+};
+
+
+// Neighbor lists with a coefficient of type T per neighbor
+template <class T>
+struct NeighborCoeffs : NeighborIds {
+    std::vector<T> coeffs;
+
+    void Resize(const std::vector<unsigned int>& rowSizes) {
+        NeighborIds::Resize(rowSizes);
+        coeffs.resize(ids.size());
+    }
+
+    size_t MemoryBytes() const {
+        return NeighborIds::MemoryBytes() + coeffs.capacity() * sizeof(T);
+    }
+};
+
+#endif // NEIGHBORLISTS_H
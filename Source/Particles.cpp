@@ -37,6 +37,7 @@ void Application::ComputeParticleAdvection()
     vec2* partVecsPointer = _partVecs->getCpuDataPointer();
     float* partAgesPointer = _partAges->getCpuDataPointer();
     BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
+    UpdateActiveBasisSets();
 
     for (uint iSubstep = 0; iSubstep < uint(_substepsParticles); iSubstep++)
     {
@@ -45,16 +46,16 @@ void Application::ComputeParticleAdvection()
             partVecsPointer[iPart] = vec2(0);
         }
 
-        // accumulate particle movement from basis velocities. Does not move particles yet.
-        for (unsigned int iBasis = 0; iBasis < _basisFlowParams->_nbElements; ++iBasis) {
+        // accumulate particle movement from basis velocities of interior and boundary bases. Does not
+        // move particles yet.
+        for (unsigned int iBasis : _simulatedBasisIds) {
+            // sleeping basis flows barely move particles
+            if (Sleeping(iBasis)) { continue; }
             BasisFlow& b = basisFlowParamsPointer[iBasis];
 
             // compute range of the basis in the particle acceleration grid, to know what particles to change.
             ivec2 gridIdsMin, gridIdsMax;
-            if ((!AllBitsSet(b.bitFlags, INTERIOR)) && (!AllBitsSet(b.bitFlags, DYNAMIC_BOUNDARY_PROJECTION))) {
-                continue;
-            }
-            else if (!b.stretched) {
+            if (!b.stretched) {
                 gridIdsMin = ivec2(_accelParticles->pointToClosestIndex(b.stretchedCornerLB));
                 gridIdsMax = ivec2(_accelParticles->pointToClosestIndex(b.stretchedCornerRT));
             }
@@ -78,9 +79,9 @@ void Application::ComputeParticleAdvection()
                     for (auto partIt = partIds->begin(); partIt != partIds->end(); partIt++) {
                         vec2 p = particlesPointer[*partIt];
                         if (AllBitsSet(b.bitFlags, INTERIOR)) {
-                            partVecsPointer[*partIt] += VecObstacle_stretch(p, b);
+                            partVecsPointer[*partIt] += VecObstacle_stretch(p, b, _basisCoeffs.coeff[iBasis]);
                         }
-                        partVecsPointer[*partIt] += b.coeffBoundary *
+                        partVecsPointer[*partIt] += _basisCoeffs.coeffBoundary[iBasis] *
                             TranslatedBasisEval(p, b.freqLvl, b.center);
                     }
                 }
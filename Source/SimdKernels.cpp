@@ -0,0 +1,301 @@
+#include "SimdKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles intrinsics of any instruction set, while GCC and Clang need it enabled per function
+#if defined(SIMD_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+// Lanes are added pairwise, in the same order in all versions
+template <class T>
+static inline T ReduceLanes(const T lanes[8])
+{
+    T s0 = lanes[0] + lanes[4];
+    T s1 = lanes[1] + lanes[5];
+    T s2 = lanes[2] + lanes[6];
+    T s3 = lanes[3] + lanes[7];
+    return (s0 + s2) + (s1 + s3);
+}
+
+// Lanes alternate x and y components of neighbors 4 * i + lane / 2
+static inline glm::vec2 ReduceLanesVec2(const float lanes[8])
+{
+    float s0 = lanes[0] + lanes[4];
+    float s1 = lanes[1] + lanes[5];
+    float s2 = lanes[2] + lanes[6];
+    float s3 = lanes[3] + lanes[7];
+    return glm::vec2(s0 + s2, s1 + s3);
+}
+
+
+//
+// Scalar
+//
+
+static float GatherDotScalar(const float* coeffs, const unsigned int* ids, const float* x, unsigned int count)
+{
+    float lanes[8] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+    for (unsigned int k = 0; k < count; k++) {
+        lanes[k % 8] += coeffs[k] * x[ids[k]];
+    }
+    return ReduceLanes(lanes);
+}
+
+
+static double GatherDotDoubleScalar(const float* coeffs, const unsigned int* ids, const double* x, unsigned int count)
+{
+    double lanes[8] = { 0., 0., 0., 0., 0., 0., 0., 0. };
+    for (unsigned int k = 0; k < count; k++) {
+        lanes[k % 8] += double(coeffs[k]) * x[ids[k]];
+    }
+    return ReduceLanes(lanes);
+}
+
+
+static glm::vec2 GatherDotVec2Scalar(
+    const glm::vec2* coeffs, const unsigned int* ids, const float* weights, unsigned int count)
+{
+    float lanes[8] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+    for (unsigned int k = 0; k < count; k++) {
+        float w = weights[ids[k]];
+        lanes[2 * (k % 4)] += coeffs[k].x * w;
+        lanes[2 * (k % 4) + 1] += coeffs[k].y * w;
+    }
+    return ReduceLanesVec2(lanes);
+}
+
+
+#ifdef SIMD_KERNELS_X86
+
+//
+// SSE2: no gather instruction, so neighbors are loaded one by one into two 4-lane registers
+//
+
+static float GatherDotSSE2(const float* coeffs, const unsigned int* ids, const float* x, unsigned int count)
+{
+    __m128 accLo = _mm_setzero_ps();
+    __m128 accHi = _mm_setzero_ps();
+    unsigned int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m128 xLo = _mm_setr_ps(x[ids[k]], x[ids[k + 1]], x[ids[k + 2]], x[ids[k + 3]]);
+        __m128 xHi = _mm_setr_ps(x[ids[k + 4]], x[ids[k + 5]], x[ids[k + 6]], x[ids[k + 7]]);
+        accLo = _mm_add_ps(accLo, _mm_mul_ps(_mm_loadu_ps(coeffs + k), xLo));
+        accHi = _mm_add_ps(accHi, _mm_mul_ps(_mm_loadu_ps(coeffs + k + 4), xHi));
+    }
+
+    float lanes[8];
+    _mm_storeu_ps(lanes, accLo);
+    _mm_storeu_ps(lanes + 4, accHi);
+    for (; k < count; k++) {
+        lanes[k % 8] += coeffs[k] * x[ids[k]];
+    }
+    return ReduceLanes(lanes);
+}
+
+
+static double GatherDotDoubleSSE2(const float* coeffs, const unsigned int* ids, const double* x, unsigned int count)
+{
+    __m128d acc[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+    unsigned int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        for (unsigned int half = 0; half < 2; half++) {
+            __m128 c = _mm_loadu_ps(coeffs + k + 4 * half);
+            __m128d xLo = _mm_setr_pd(x[ids[k + 4 * half]], x[ids[k + 4 * half + 1]]);
+            __m128d xHi = _mm_setr_pd(x[ids[k + 4 * half + 2]], x[ids[k + 4 * half + 3]]);
+            acc[2 * half] = _mm_add_pd(acc[2 * half], _mm_mul_pd(_mm_cvtps_pd(c), xLo));
+            acc[2 * half + 1] = _mm_add_pd(acc[2 * half + 1], _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(c, c)), xHi));
+        }
+    }
+
+    double lanes[8];
+    for (unsigned int i = 0; i < 4; i++) {
+        _mm_storeu_pd(lanes + 2 * i, acc[i]);
+    }
+    for (; k < count; k++) {
+        lanes[k % 8] += double(coeffs[k]) * x[ids[k]];
+    }
+    return ReduceLanes(lanes);
+}
+
+
+static glm::vec2 GatherDotVec2SSE2(
+    const glm::vec2* coeffs, const unsigned int* ids, const float* weights, unsigned int count)
+{
+    const float* coeffsPointer = reinterpret_cast<const float*>(coeffs);
+    __m128 accLo = _mm_setzero_ps();
+    __m128 accHi = _mm_setzero_ps();
+    unsigned int k = 0;
+    for (; k + 4 <= count; k += 4) {
+        float w0 = weights[ids[k]];
+        float w1 = weights[ids[k + 1]];
+        float w2 = weights[ids[k + 2]];
+        float w3 = weights[ids[k + 3]];
+        accLo = _mm_add_ps(accLo, _mm_mul_ps(_mm_loadu_ps(coeffsPointer + 2 * k), _mm_setr_ps(w0, w0, w1, w1)));
+        accHi = _mm_add_ps(accHi, _mm_mul_ps(_mm_loadu_ps(coeffsPointer + 2 * k + 4), _mm_setr_ps(w2, w2, w3, w3)));
+    }
+
+    float lanes[8];
+    _mm_storeu_ps(lanes, accLo);
+    _mm_storeu_ps(lanes + 4, accHi);
+    for (; k < count; k++) {
+        float w = weights[ids[k]];
+        lanes[2 * (k % 4)] += coeffs[k].x * w;
+        lanes[2 * (k % 4) + 1] += coeffs[k].y * w;
+    }
+    return ReduceLanesVec2(lanes);
+}
+
+
+//
+// AVX2: hardware gathers of 8 neighbors at a time
+//
+
+SIMD_TARGET_AVX2
+static float GatherDotAVX2(const float* coeffs, const unsigned int* ids, const float* x, unsigned int count)
+{
+    __m256 acc = _mm256_setzero_ps();
+    unsigned int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m256i ids8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + k));
+        __m256 xs = _mm256_i32gather_ps(x, ids8, 4);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(coeffs + k), xs));
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    for (; k < count; k++) {
+        lanes[k % 8] += coeffs[k] * x[ids[k]];
+    }
+    return ReduceLanes(lanes);
+}
+
+
+SIMD_TARGET_AVX2
+static double GatherDotDoubleAVX2(const float* coeffs, const unsigned int* ids, const double* x, unsigned int count)
+{
+    __m256d accLo = _mm256_setzero_pd();
+    __m256d accHi = _mm256_setzero_pd();
+    unsigned int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m128i idsLo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + k));
+        __m128i idsHi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + k + 4));
+        __m256d cLo = _mm256_cvtps_pd(_mm_loadu_ps(coeffs + k));
+        __m256d cHi = _mm256_cvtps_pd(_mm_loadu_ps(coeffs + k + 4));
+        accLo = _mm256_add_pd(accLo, _mm256_mul_pd(cLo, _mm256_i32gather_pd(x, idsLo, 8)));
+        accHi = _mm256_add_pd(accHi, _mm256_mul_pd(cHi, _mm256_i32gather_pd(x, idsHi, 8)));
+    }
+
+    double lanes[8];
+    _mm256_storeu_pd(lanes, accLo);
+    _mm256_storeu_pd(lanes + 4, accHi);
+    for (; k < count; k++) {
+        lanes[k % 8] += double(coeffs[k]) * x[ids[k]];
+    }
+    return ReduceLanes(lanes);
+}
+
+
+SIMD_TARGET_AVX2
+static glm::vec2 GatherDotVec2AVX2(
+    const glm::vec2* coeffs, const unsigned int* ids, const float* weights, unsigned int count)
+{
+    const float* coeffsPointer = reinterpret_cast<const float*>(coeffs);
+    const __m256i duplicateIds = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    __m256 acc = _mm256_setzero_ps();
+    unsigned int k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m128i ids4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + k));
+        __m256i ids8 = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(ids4), duplicateIds);
+        __m256 w8 = _mm256_i32gather_ps(weights, ids8, 4);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(coeffsPointer + 2 * k), w8));
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    for (; k < count; k++) {
+        float w = weights[ids[k]];
+        lanes[2 * (k % 4)] += coeffs[k].x * w;
+        lanes[2 * (k % 4) + 1] += coeffs[k].y * w;
+    }
+    return ReduceLanesVec2(lanes);
+}
+
+#endif // SIMD_KERNELS_X86
+
+
+SimdLevel DetectSimdLevel()
+{
+#ifdef SIMD_KERNELS_X86
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int nbIds = info[0];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool avx2 = false;
+    if (nbIds >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    // the OS must also save the AVX registers
+    if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6) {
+        return SimdLevel::AVX2;
+    }
+    return sse2 ? SimdLevel::SSE2 : SimdLevel::Scalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    return __builtin_cpu_supports("sse2") ? SimdLevel::SSE2 : SimdLevel::Scalar;
+#endif
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+
+const char* SimdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::AVX2: return "AVX2";
+    case SimdLevel::SSE2: return "SSE2";
+    default: return "scalar";
+    }
+}
+
+
+SimdKernels GetSimdKernels(SimdLevel level)
+{
+    SimdKernels kernels;
+    kernels.level = level;
+    kernels.gatherDot = GatherDotScalar;
+    kernels.gatherDotDouble = GatherDotDoubleScalar;
+    kernels.gatherDotVec2 = GatherDotVec2Scalar;
+#ifdef SIMD_KERNELS_X86
+    if (level == SimdLevel::SSE2) {
+        kernels.gatherDot = GatherDotSSE2;
+        kernels.gatherDotDouble = GatherDotDoubleSSE2;
+        kernels.gatherDotVec2 = GatherDotVec2SSE2;
+    }
+    else if (level == SimdLevel::AVX2) {
+        kernels.gatherDot = GatherDotAVX2;
+        kernels.gatherDotDouble = GatherDotDoubleAVX2;
+        kernels.gatherDotVec2 = GatherDotVec2AVX2;
+    }
+#else
+    kernels.level = SimdLevel::Scalar;
+#endif
+    return kernels;
+}
@@ -0,0 +1,38 @@
+// Gather kernels for the sparse rows of the simulation: the B^T.B rows of the Gauss-Seidel solve and the
+// transport rows of the basis advection. Each kernel has a scalar, an SSE2 and an AVX2 version, chosen at
+// runtime from what the CPU supports. All versions accumulate in 8 lanes, neighbor k going to lane
+// k % 8, and add the lanes up in the same order, so they return exactly the same results on any CPU.
+
+#ifndef SIMDKERNELS_H
+#define SIMDKERNELS_H
+
+#include <glm/glm.hpp>
+
+enum class SimdLevel { Scalar, SSE2, AVX2 };
+
+// Best level supported by the CPU and the OS
+SimdLevel DetectSimdLevel();
+
+const char* SimdLevelName(SimdLevel level);
+
+// Sum over k < count of coeffs[k] * x[ids[k]], see Application::InverseBBMatrixMain. The double
+// version is the one of solves in double precision.
+typedef float (*GatherDotFunction)(const float* coeffs, const unsigned int* ids, const float* x, unsigned int count);
+typedef double (*GatherDotDoubleFunction)(
+    const float* coeffs, const unsigned int* ids, const double* x, unsigned int count);
+
+// Sum over k < count of coeffs[k] * weights[ids[k]], see Application::ComputeBasisAdvection
+typedef glm::vec2 (*GatherDotVec2Function)(
+    const glm::vec2* coeffs, const unsigned int* ids, const float* weights, unsigned int count);
+
+struct SimdKernels {
+    SimdLevel level;
+    GatherDotFunction gatherDot;
+    GatherDotDoubleFunction gatherDotDouble;
+    GatherDotVec2Function gatherDotVec2;
+};
+
+// Kernels of the given level, which must be supported by the CPU
+SimdKernels GetSimdKernels(SimdLevel level);
+
+#endif // SIMDKERNELS_H
@@ -6,6 +6,8 @@ void Application::SimulationStep()
 {
     _velocityGridNeedsUpdating = true;
 
+    UpdateLazyCoeffs();
+
     // update dynamic obstacles
     for (Obstacle* obs : _obstacles) {
         if (obs->dynamic) {
@@ -22,41 +24,30 @@ void Application::SimulationStep()
 
     BasisFlow* basisFlowParamsPointer = _basisFlowParams->getCpuDataPointer();
 
-    // set prevBitFlags
-    for (unsigned int iBasis = 0; iBasis < _basisFlowParams->_nbElements; ++iBasis) {
-        BasisFlow& b = basisFlowParamsPointer[iBasis];
-        b.coeffBoundary = 0;
-    }
-
     // compute stretch ratio, "valid" bool, and stretchedCorners
     if (_basisStretchedUpdateRequired)
     {
-        // Reset flags
-        for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
-            basisFlowParamsPointer[i].bitFlags = 0;
-        }
-
         ComputeStretches();
         _basisStretchedUpdateRequired = false;
+        _activeBasisSetsNeedUpdating = true;
+    }
 
-        // save stretch flags
+    // Bases without coefficients yet are left out of the simulation, see _lazyCoeffs. Flags only
+    // change with the stretches or the number of active bases, which both update the active sets.
+    if (_activeBasisSetsNeedUpdating) {
         for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
-            basisFlowParamsPointer[i].stretchBitFlags = basisFlowParamsPointer[i].bitFlags;
+            basisFlowParamsPointer[i].bitFlags = i < _nbActiveBasisFlows ? basisFlowParamsPointer[i].stretchBitFlags : 0;
         }
     }
 
-    for (unsigned int i = 0; i < _basisFlowParams->_nbElements; ++i) {
-        basisFlowParamsPointer[i].bitFlags = basisFlowParamsPointer[i].stretchBitFlags;
-    }
-
     SetParticlesInAccelGrid();
 
-    ProjectDynamicObstacleBoundaryMotion();
+    // project obstacle motion and particle buoyancy to basis flows
+    ProjectForcesAndBoundaryMotion();
 
     // Advect bases
     ComputeBasisAdvection();
 
-    // project particle buoyancy to basis flows
     if (_useForcesFromParticles) {
         AddParticleForcesToBasisFlows();
     }
@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Number of times an idle thread checks for new work before sleeping
+static const int THREAD_POOL_SPIN_COUNT = 4096;
+
+ThreadPool::ThreadPool(unsigned int nbThreads)
+{
+    for (unsigned int iThread = 1; iThread < nbThreads; iThread++) {
+        _workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stop = true;
+        _generation++;
+    }
+    _workAvailable.notify_all();
+    for (thread& worker : _workers) {
+        worker.join();
+    }
+}
+
+
+void ThreadPool::Run(int nbTasks, TaskFunction function, void* context)
+{
+    if (nbTasks <= 1 || _workers.empty()) {
+        for (int iTask = 0; iTask < nbTasks; iTask++) {
+            function(context, iTask);
+        }
+        return;
+    }
+
+    // no worker can be running a task here, since all tasks of the previous loop are done
+    uint32_t generation;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _nbTasks.store(nbTasks, memory_order_relaxed);
+        _function = function;
+        _context = context;
+        _nbTasksDone.store(0, memory_order_relaxed);
+        generation = _generation.load(memory_order_relaxed) + 1;
+        _nextTask.store(uint64_t(generation) << 32, memory_order_release);
+        _generation.store(generation, memory_order_release);
+    }
+    _workAvailable.notify_all();
+
+    RunTasks(generation);
+
+    for (int iSpin = 0; _nbTasksDone.load(memory_order_acquire) < nbTasks; iSpin++) {
+        if (iSpin < THREAD_POOL_SPIN_COUNT) {
+            this_thread::yield();
+        }
+        else {
+            unique_lock<mutex> lock(_mutex);
+            _workDone.wait(lock, [&]() { return _nbTasksDone.load(memory_order_acquire) >= nbTasks; });
+        }
+    }
+}
+
+
+void ThreadPool::RunTasks(uint32_t generation)
+{
+    uint64_t nextTask = _nextTask.load(memory_order_acquire);
+    while (true) {
+        if (uint32_t(nextTask >> 32) != generation ||
+            int(nextTask & 0xffffffffu) >= _nbTasks.load(memory_order_relaxed))
+        {
+            return;
+        }
+        if (!_nextTask.compare_exchange_weak(nextTask, nextTask + 1, memory_order_acq_rel)) { continue; }
+
+        _function(_context, int(nextTask & 0xffffffffu));
+
+        if (_nbTasksDone.fetch_add(1, memory_order_acq_rel) + 1 == _nbTasks.load(memory_order_relaxed)) {
+            lock_guard<mutex> lock(_mutex);
+            _workDone.notify_all();
+        }
+        nextTask = _nextTask.load(memory_order_acquire);
+    }
+}
+
+
+void ThreadPool::WorkerLoop()
+{
+    uint32_t lastGeneration = 0;
+    while (true) {
+        uint32_t generation = _generation.load(memory_order_acquire);
+        for (int iSpin = 0; generation == lastGeneration && iSpin < THREAD_POOL_SPIN_COUNT; iSpin++) {
+            this_thread::yield();
+            generation = _generation.load(memory_order_acquire);
+        }
+        if (generation == lastGeneration) {
+            unique_lock<mutex> lock(_mutex);
+            _workAvailable.wait(lock, [&]() { return _generation.load(memory_order_acquire) != lastGeneration; });
+            generation = _generation.load(memory_order_acquire);
+        }
+        lastGeneration = generation;
+
+        if (_stop) { return; }
+        RunTasks(generation);
+    }
+}
@@ -0,0 +1,66 @@
+// Persistent worker threads for loops that are too short to pay for creating threads on every call,
+// such as the sweep of each orthogonal group in InverseBBMatrix. Workers spin for a short while
+// after a loop before sleeping, so back to back loops are picked up without waking them again.
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // nbThreads includes the thread calling ParallelFor, so nbThreads - 1 workers are started
+    explicit ThreadPool(unsigned int nbThreads = std::max(1u, std::thread::hardware_concurrency()));
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int NbThreads() const { return (unsigned int)_workers.size() + 1; }
+
+    // Calls function(i) for every i in [begin, end), split in nbTasks ranges of consecutive
+    // iterations that run in parallel. Returns once all iterations are done. Runs on the calling
+    // thread only if nbTasks is 1. Must not be called from several threads at once.
+    template <class Function>
+    void ParallelFor(int begin, int end, int nbTasks, Function function)
+    {
+        auto task = [&](int iTask) {
+            int taskBegin = begin + int(int64_t(end - begin) * iTask / nbTasks);
+            int taskEnd = begin + int(int64_t(end - begin) * (iTask + 1) / nbTasks);
+            for (int i = taskBegin; i < taskEnd; i++) {
+                function(i);
+            }
+        };
+        Run(nbTasks, [](void* context, int iTask) { (*static_cast<decltype(task)*>(context))(iTask); }, &task);
+    }
+
+private:
+    typedef void (*TaskFunction)(void* context, int iTask);
+
+    void Run(int nbTasks, TaskFunction function, void* context);
+    void RunTasks(uint32_t generation);
+    void WorkerLoop();
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _workDone;
+    std::atomic<bool> _stop{ false };
+
+    // current loop. _nextTask holds the generation of the loop in its high 32 bits and the index
+    // of the next task to run in its low 32 bits, so that a worker that is late for a loop never
+    // takes a task of the next one.
+    std::atomic<uint32_t> _generation{ 0 };
+    std::atomic<uint64_t> _nextTask{ 0 };
+    std::atomic<int> _nbTasksDone{ 0 };
+    std::atomic<int> _nbTasks{ 0 };
+    TaskFunction _function = nullptr;
+    void* _context = nullptr;
+};
+
+#endif // THREADPOOL_H
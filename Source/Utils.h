@@ -5,6 +5,10 @@
 #include <chrono>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #define M_PI 3.141592653589793238462643
 
@@ -91,6 +95,34 @@ inline float VecNorm(glm::vec3 vec) {
 }
 
 
+// Calls function(i) for every i in [begin, end) using all hardware threads. Threads take chunks of
+// chunkSize consecutive iterations until none are left. function must be safe to call concurrently.
+template <class Function>
+inline void ParallelFor(int begin, int end, Function function, int chunkSize = 16) {
+    unsigned int nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<int> nextChunkBegin(begin);
+
+    auto worker = [&]() {
+        for (int chunkBegin = nextChunkBegin.fetch_add(chunkSize); chunkBegin < end;
+            chunkBegin = nextChunkBegin.fetch_add(chunkSize)) {
+            int chunkEnd = std::min(chunkBegin + chunkSize, end);
+            for (int i = chunkBegin; i < chunkEnd; i++) {
+                function(i);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int iThread = 1; iThread < nbThreads; iThread++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+
 inline void PrintTime() {
     time_t rawtime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
     tm timeinfo;
@@ -49,6 +49,20 @@ void VectorField2D::addFunction(std::function<vec2(float, float)> function)
 }
 
 
+bool VectorField2D::isZero()
+{
+    vec2* _vectorsPointer = _vectors.getCpuDataPointer();
+    unsigned int nbVectors = _vectors._nbElementsX * _vectors._nbElementsY;
+
+    for (unsigned int i = 0; i < nbVectors; i++) {
+        if (_vectorsPointer[i] != vec2(0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 vec2 VectorField2D::interp(vec2 pos)
 {
     float x = pos.x;
@@ -24,6 +24,7 @@ public:
     void populateWithFunction(std::function<glm::vec2(float x, float y)> function);
     void addFunction(std::function<glm::vec2(float x, float y)> function);
     glm::vec2 interp(glm::vec2 pos);
+    bool isZero();
 
     void addVectorCpuData(unsigned int i, unsigned int j, glm::vec2 data);
     void setVectorCpuData(unsigned int i, unsigned int j, glm::vec2 data);